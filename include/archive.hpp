@@ -0,0 +1,105 @@
+#ifndef CRYPTSTREAM_ARCHIVE_HPP
+#define CRYPTSTREAM_ARCHIVE_HPP
+
+#include "task_queue.hpp"
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace cryptstream {
+
+/**
+ * Packed encrypted archive: many small files in a few large segments
+ * An archive is a directory. Each pool worker appends members to its own
+ * "seg-NNN" file (NNN = worker slot) and records where each one landed in
+ * "seg-NNN.list"; once the batch is done the lists are merged into a
+ * name-sorted "index" that ArchiveIndex maps and binary-searches.
+ * Every member is encrypted on its own, with the key stream from offset 0
+ */
+class Archive {
+public:
+    static constexpr char INDEX_MAGIC[4] = {'C', 'S', 'A', 'X'};
+    static constexpr uint32_t INDEX_VERSION = 1;
+    
+    /**
+     * Index file layout (host byte order, mapped as is): header, entries
+     * sorted by name, then the name bytes they point into
+     */
+    struct IndexHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t count;
+        uint64_t names_offset;      // File offset of the name blob
+    };
+    
+    struct IndexEntry {
+        uint64_t name_offset;       // Into the name blob
+        uint32_t name_length;
+        uint32_t segment;
+        uint64_t offset;            // Member start within the segment
+        uint64_t length;
+    };
+    
+    static_assert(sizeof(IndexHeader) == 24, "Index header layout");
+    static_assert(sizeof(IndexEntry) == 32, "Index entry layout");
+    
+    // Create an empty archive directory; fails if it exists and is not empty
+    static bool create(const std::string& dir);
+    
+    // Worker side: encrypt the task's input and append it to the segment of
+    // the given slot; the segment stays open across tasks of the same archive
+    static bool append(const TaskSpec& task, size_t segment, size_t chunk_bytes);
+    
+    // Merge the per-segment lists into the sorted index and remove them.
+    // A member recorded twice (a requeued task) keeps its first copy
+    static bool write_index(const std::string& dir, size_t* members = nullptr);
+    
+    static std::string segment_path(const std::string& dir, uint32_t segment);
+    static std::string index_path(const std::string& dir);
+};
+
+/**
+ * Read-only view of an archive's index: mmap'd, O(log n) lookup by name
+ */
+class ArchiveIndex {
+public:
+    /**
+     * Where one member's encrypted bytes live
+     */
+    struct Member {
+        std::string name;
+        uint32_t segment;
+        uint64_t offset;
+        uint64_t length;
+    };
+    
+    // Throws std::runtime_error if the index is missing or malformed
+    explicit ArchiveIndex(const std::string& dir);
+    ~ArchiveIndex();
+    
+    ArchiveIndex(const ArchiveIndex&) = delete;
+    ArchiveIndex& operator=(const ArchiveIndex&) = delete;
+    
+    size_t size() const { return count_; }
+    Member at(size_t i) const;
+    
+    // Binary search by name
+    bool find(const std::string& name, Member& member) const;
+    
+    // Decrypt one member into output; reads only that member's bytes
+    bool extract(const Member& member, const std::string& key,
+                 const std::string& output) const;
+
+private:
+    std::string dir_;
+    void* map_;
+    size_t map_size_;
+    const Archive::IndexEntry* entries_;
+    const char* names_;
+    size_t count_;
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_ARCHIVE_HPP
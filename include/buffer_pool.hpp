@@ -0,0 +1,85 @@
+#ifndef CRYPTSTREAM_BUFFER_POOL_HPP
+#define CRYPTSTREAM_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cryptstream {
+
+/**
+ * Cache of block-aligned data buffers, reused from task to task
+ * O_DIRECT needs buffer addresses, lengths and file offsets aligned to the
+ * device's logical block size; 4 KB covers every common device
+ */
+class BufferPool {
+public:
+    static constexpr size_t ALIGNMENT = 4096;
+    static constexpr size_t MAX_CACHED = 4;   // Idle buffers kept per pool
+    
+    /**
+     * Buffer on loan from a pool, handed back when destroyed
+     */
+    class Buffer {
+    public:
+        Buffer() = default;
+        ~Buffer();
+        
+        // Move-only
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        
+        uint8_t* data() { return data_; }
+        size_t size() const { return size_; }
+    
+    private:
+        friend class BufferPool;
+        Buffer(BufferPool* pool, uint8_t* data, size_t size)
+            : pool_(pool), data_(data), size_(size) {}
+        
+        BufferPool* pool_ = nullptr;
+        uint8_t* data_ = nullptr;
+        size_t size_ = 0;
+        
+        void release();
+    };
+    
+    BufferPool() = default;
+    ~BufferPool();
+    
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    
+    // Borrow an aligned buffer of at least size bytes (rounded up to
+    // ALIGNMENT), reusing the smallest idle buffer that is large enough
+    Buffer acquire(size_t size);
+    
+    // The calling thread's pool; each worker process has its own
+    static BufferPool& local();
+    
+    // Buffers allocated vs. loans served from the cache
+    size_t allocations() const { return allocations_; }
+    size_t reuses() const { return reuses_; }
+    
+    static size_t round_up(size_t value) {
+        return (value + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+private:
+    struct Slab {
+        uint8_t* data;
+        size_t size;
+    };
+    
+    std::vector<Slab> idle_;
+    size_t allocations_ = 0;
+    size_t reuses_ = 0;
+    
+    void give_back(uint8_t* data, size_t size);
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_BUFFER_POOL_HPP
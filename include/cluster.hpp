@@ -0,0 +1,143 @@
+#ifndef CRYPTSTREAM_CLUSTER_HPP
+#define CRYPTSTREAM_CLUSTER_HPP
+
+#include "task_queue.hpp"
+#include "event_log.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace cryptstream {
+
+/**
+ * Settings shared by both ends of a multi-node run
+ */
+struct ClusterOptions {
+    std::string address;                // host:port to listen on or connect to
+    std::string key;                    // Never sent; each side proves it by HMAC
+    bool stream = false;                // Ship chunk data instead of file paths
+    size_t workers_hint = 4;            // Expected workers, sizes split ranges
+    uint32_t flags = 0;                 // TaskSpec flags for every task (path mode)
+    unsigned int lease_timeout_ms = 0;  // Drop a worker silent this long on a unit
+    unsigned int connect_timeout_ms = 10000;   // Worker: keep retrying this long
+    LogLevel log_level = LogLevel::INFO;
+};
+
+/**
+ * Outcome of a coordinated batch
+ */
+struct ClusterResult {
+    size_t units = 0;
+    size_t tasks = 0;
+    size_t succeeded = 0;
+    size_t failed = 0;
+    uint64_t bytes = 0;
+    size_t workers = 0;             // Workers that joined over the run
+    size_t lost_workers = 0;        // Disconnected or timed out holding a unit
+    size_t requeued_units = 0;
+    double elapsed_ms = 0.0;
+};
+
+/**
+ * Multi-node coordinator: serves a batch's work units over TCP
+ * The batch is planned by the Scheduler as for a local pool. Workers pull
+ * one unit at a time; a unit whose worker disconnects or exceeds the lease
+ * timeout goes back to the front of the queue, like a dead local worker's
+ * lease. In path mode workers open the files themselves (shared
+ * filesystem); in stream mode the coordinator sends each chunk's bytes and
+ * writes the returned output, so workers need no access to the files
+ */
+class Coordinator {
+public:
+    static constexpr uint64_t STREAM_CHUNK_BYTES = 1024 * 1024;
+    
+    explicit Coordinator(const ClusterOptions& options);
+    ~Coordinator();
+    
+    Coordinator(const Coordinator&) = delete;
+    Coordinator& operator=(const Coordinator&) = delete;
+    
+    // Bind and listen on options.address; returns the port (useful for port 0)
+    uint16_t listen();
+    
+    // Serve every file pair to connecting workers until all units finish
+    ClusterResult run(TaskSpec::Type type,
+                      const std::vector<std::pair<std::string, std::string>>& files);
+
+private:
+    /**
+     * One connected worker
+     */
+    struct Client {
+        int fd;
+        std::string name;
+        std::vector<uint8_t> inbox;     // Bytes received, not yet a whole frame
+        std::string worker_nonce;       // From HELLO
+        std::string challenge;          // Nonce sent in CHALLENGE, empty before HELLO
+        bool welcomed = false;          // Proved the key
+        bool waiting = false;           // Asked for work while none was pending
+        long unit = -1;                 // Unit in progress, -1 = none
+        uint64_t heard_ns = 0;          // Last frame received or unit sent
+    };
+    
+    struct Unit {
+        std::vector<TaskSpec> tasks;    // Stream mode: one chunk of one file
+        uint64_t bytes = 0;
+        uint8_t requeues = 0;           // Workers lost holding it; capped
+        bool done = false;
+    };
+    
+    ClusterOptions options_;
+    int listen_fd_;
+    std::vector<Client> clients_;
+    std::vector<Unit> units_;
+    std::deque<size_t> pending_;
+    size_t remaining_;
+    ClusterResult result_;
+    
+    std::vector<Unit> plan(TaskSpec::Type type,
+                           const std::vector<std::pair<std::string, std::string>>& files);
+    void accept_clients();
+    bool receive(Client& client);
+    bool handle_frame(Client& client, uint8_t type, const std::vector<uint8_t>& payload);
+    bool dispatch(Client& client);
+    void finish_unit(Client& client, const std::vector<bool>& results);
+    void drop(size_t index, const char* reason);
+};
+
+/**
+ * Remote worker: `cryptstream worker --connect host:port`
+ * Pulls units from a Coordinator and processes them with FileProcessor
+ * (path mode) or in memory (stream mode), reporting per-task outcomes
+ */
+class RemoteWorker {
+public:
+    explicit RemoteWorker(const ClusterOptions& options);
+    ~RemoteWorker();
+    
+    RemoteWorker(const RemoteWorker&) = delete;
+    RemoteWorker& operator=(const RemoteWorker&) = delete;
+    
+    // Connect, then process units until the coordinator says the batch is
+    // done; returns the number of units processed. A connection lost after
+    // joining is reconnected; throws on refusal, protocol errors or an
+    // unreachable coordinator, including a key that does not match
+    size_t run();
+
+private:
+    ClusterOptions options_;
+    int fd_;
+    
+    void connect_with_retry();
+    
+    // One connection: handshake, then units until BYE; joined is set once
+    // both sides proved the key
+    void serve(size_t& processed, bool& joined);
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_CLUSTER_HPP
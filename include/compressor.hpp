@@ -0,0 +1,36 @@
+#ifndef CRYPTSTREAM_COMPRESSOR_HPP
+#define CRYPTSTREAM_COMPRESSOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cryptstream {
+
+/**
+ * Self-contained LZ77 block codec (LZ4-style sequences)
+ * Each block is independent: no dictionary carries over, so any chunk of a
+ * stream can be decoded on its own. Greedy hash-table matching with a 64 KB
+ * window favours speed over ratio
+ *
+ * Sequence: token (literal length << 4 | match length - 4), optional
+ * 255-run length extensions, literals, 2-byte little-endian offset.
+ * The final sequence carries literals only
+ */
+class Compressor {
+public:
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr size_t MAX_OFFSET = 65535;
+    
+    // Worst-case compressed size of n input bytes
+    static size_t bound(size_t n) { return n + n / 255 + 16; }
+    
+    // Compress n bytes into dst (capacity >= bound(n)); returns the size
+    static size_t compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity);
+    
+    // Decode a block that must expand to exactly out_n bytes; false if corrupt
+    static bool decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t out_n);
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_COMPRESSOR_HPP
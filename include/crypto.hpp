@@ -24,6 +24,12 @@ public:
     // Encrypt/decrypt are symmetric for XOR
     void process(std::vector<uint8_t>& data);
     
+    // Process a raw buffer in-place (page-backed or shared buffers)
+    void process(uint8_t* data, size_t size);
+    
+    // Position the key stream at a byte offset (range processing)
+    void seek(uint64_t position);
+    
 private:
     std::vector<uint8_t> key_;
     size_t key_index_;
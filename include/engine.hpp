@@ -0,0 +1,208 @@
+#ifndef CRYPTSTREAM_ENGINE_HPP
+#define CRYPTSTREAM_ENGINE_HPP
+
+#include "task_queue.hpp"
+#include "shared_memory.hpp"
+#include "process_pool.hpp"
+#include "scheduler.hpp"
+#include "throttle.hpp"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cryptstream {
+
+/**
+ * Engine configuration: pool sizing, buffers and shared memory naming
+ */
+struct EngineOptions {
+    size_t min_processes = 1;
+    size_t max_processes = 4;
+    unsigned int idle_timeout_ms = 0;
+    unsigned int lease_timeout_ms = 0;
+    bool huge_pages = false;
+    LogLevel log_level = LogLevel::INFO;
+    bool trace = false;                         // Record per-stage task spans
+    uint64_t memory_budget = 0;                 // Data buffer bytes; 0 = half of RAM
+    uint64_t chunk_bytes = MemoryBudget::DEFAULT_CHUNK_BYTES;
+    size_t prefetch_depth = 4;                  // Queued inputs to read ahead; 0 = off
+    bool drop_cache = true;                     // DONTNEED finished inputs and outputs
+    bool durable = false;                       // Temp file + group commit + rename
+    bool compress = false;                      // LZ frames: compress then encrypt
+    bool direct = false;                        // O_DIRECT reads and writes
+    bool sparse = false;                        // Skip holes and zero blocks
+    size_t reserved_workers = 0;                // Workers kept for high-priority jobs
+    uint32_t priority_weights[TaskQueue::PRIORITY_CLASSES] = {16, 4, 1};
+    Throttle::Limits io_limits;                 // Shared by all workers; 0 = unlimited
+    std::string name_prefix = "/cryptstream";   // Run names: <prefix>.<pid>.<nonce>
+    Scheduler::Options scheduling;
+};
+
+/**
+ * Outcome of one submitted job
+ */
+struct JobResult {
+    bool success = false;
+    size_t tasks = 0;           // Tasks the job was split/packed into
+    size_t failed = 0;
+    size_t units = 0;           // Dequeue units
+    uint64_t bytes = 0;
+    double predicted_makespan_ms = 0.0;
+    double lower_bound_ms = 0.0;
+    double elapsed_ms = 0.0;
+    std::string error;
+};
+
+/**
+ * Pool-wide counters for reporting
+ */
+struct EngineStats {
+    size_t peak_workers = 0;
+    size_t crashed_workers = 0;
+    size_t requeued_units = 0;
+    PageMode queue_page_mode = PageMode::STANDARD;
+    uint64_t memory_budget = 0;
+    uint64_t peak_buffer_bytes = 0;     // Most budget bytes reserved at once
+    size_t chunked_tasks = 0;           // Tasks streamed because they did not fit
+    
+    // Submit-to-dequeue wait per priority class (TaskSpec::Priority order)
+    TaskQueue::WaitStats queue_wait[TaskQueue::PRIORITY_CLASSES] = {};
+    
+    // Worker time spent waiting on I/O limits (Throttle::Resource order)
+    uint64_t throttled_ns[Throttle::RESOURCES] = {};
+};
+
+/**
+ * Embeddable encryption engine
+ * Created once (queue, semaphores, process pool, dispatcher thread), then
+ * accepts asynchronous file, range and buffer jobs. Each submit returns a
+ * future and optionally invokes a completion callback on the engine's
+ * dispatcher thread (file jobs) or the job's own thread (buffer jobs)
+ *
+ * File jobs carry a priority class: the dispatcher feeds the queue's
+ * high ring first and workers dequeue by class weight, so a small urgent
+ * job overtakes a large bulk batch already in progress
+ */
+class Engine {
+public:
+    using Callback = std::function<void(const JobResult&)>;
+    
+    explicit Engine(const EngineOptions& options = EngineOptions());
+    ~Engine();
+    
+    // Non-copyable
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+    
+    // Encrypt/decrypt a whole file; large files are split across workers
+    std::future<JobResult> submit_file(TaskSpec::Type type, const std::string& input,
+                                       const std::string& output, const std::string& key,
+                                       Callback on_complete = nullptr,
+                                       TaskSpec::Priority priority = TaskSpec::PRIORITY_NORMAL);
+    
+    // Many files with one key: split, packed and ordered by the scheduler
+    std::future<JobResult> submit_batch(TaskSpec::Type type,
+                                        const std::vector<std::pair<std::string, std::string>>& files,
+                                        const std::string& key, Callback on_complete = nullptr,
+                                        TaskSpec::Priority priority = TaskSpec::PRIORITY_NORMAL);
+    
+    // Encrypt many files into a packed archive directory (see Archive); the
+    // index is written once every member is in, before the job completes
+    std::future<JobResult> submit_pack(const std::vector<std::string>& inputs,
+                                       const std::string& archive, const std::string& key,
+                                       Callback on_complete = nullptr,
+                                       TaskSpec::Priority priority = TaskSpec::PRIORITY_NORMAL);
+    
+    // One byte range of input into a pre-sized output at the same offset
+    std::future<JobResult> submit_range(TaskSpec::Type type, const std::string& input,
+                                        const std::string& output, const std::string& key,
+                                        uint64_t offset, uint64_t length,
+                                        Callback on_complete = nullptr,
+                                        TaskSpec::Priority priority = TaskSpec::PRIORITY_NORMAL);
+    
+    // In-memory path: process a caller-owned buffer in place, no disk or IPC.
+    // Deliberately outside the pool: workers are other processes and cannot
+    // see the caller's memory, and the engine allocates nothing for the job,
+    // so neither the queue nor the memory budget applies. Each call runs on
+    // its own std::async thread, so callers bound their own concurrency.
+    // The buffer must stay alive until the future is ready
+    std::future<JobResult> submit_buffer(TaskSpec::Type type, uint8_t* data, size_t size,
+                                         const std::string& key, uint64_t stream_offset = 0,
+                                         Callback on_complete = nullptr);
+    
+    // Change the I/O limits; units already running pick them up at their
+    // next chunk
+    void set_limits(const Throttle::Limits& limits);
+    Throttle::Limits limits() const;
+    
+    // Wait for outstanding jobs, then stop workers and release IPC objects
+    void shutdown();
+    
+    EngineStats stats() const;
+    
+    // Write recorded spans as Chrome trace JSON (requires EngineOptions::trace)
+    bool write_trace(const std::string& path) const;
+
+private:
+    // Runs on the dispatcher thread once all units are done, before the
+    // job's outcome is decided; reports failure through result.error
+    using Finalizer = std::function<void(JobResult&)>;
+    
+    struct Job {
+        std::promise<JobResult> promise;
+        Callback on_complete;
+        Finalizer finalize;
+        JobResult result;
+        size_t remaining = 0;
+        std::chrono::steady_clock::time_point started;
+    };
+    
+    struct PendingUnit {
+        uint64_t job_id;
+        std::vector<TaskSpec> tasks;
+    };
+    
+    EngineOptions options_;
+    std::string run_name_;
+    std::unique_ptr<SharedMemory> shm_;
+    std::unique_ptr<TaskQueue> queue_;
+    std::unique_ptr<Semaphore> task_sem_;
+    std::unique_ptr<Semaphore> done_sem_;
+    std::unique_ptr<Semaphore> urgent_sem_;
+    std::unique_ptr<SharedMemory> throttle_shm_;
+    std::unique_ptr<Throttle> throttle_;
+    std::unique_ptr<ProcessPool> pool_;
+    
+    mutable std::mutex mutex_;
+    std::map<uint64_t, Job> jobs_;
+    std::deque<PendingUnit> pending_[TaskQueue::PRIORITY_CLASSES];
+    uint64_t next_job_id_;
+    bool stopping_;
+    bool stopped_;
+    EngineStats final_stats_;
+    std::thread dispatcher_;
+    
+    uint32_t task_flags() const;
+    std::future<JobResult> submit_planned(TaskSpec::Type type,
+                                          const std::vector<std::pair<std::string, std::string>>& files,
+                                          const std::string& key, uint32_t flags,
+                                          TaskSpec::Priority priority, Callback on_complete,
+                                          Finalizer finalize = nullptr);
+    std::future<JobResult> add_job(std::vector<std::vector<TaskSpec>> units,
+                                   JobResult planned, TaskSpec::Priority priority,
+                                   Callback on_complete, Finalizer finalize = nullptr);
+    void dispatch_loop();
+    void finish_job(std::map<uint64_t, Job>::iterator it);
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_ENGINE_HPP
@@ -0,0 +1,123 @@
+#ifndef CRYPTSTREAM_EVENT_LOG_HPP
+#define CRYPTSTREAM_EVENT_LOG_HPP
+
+#include "shared_memory.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cryptstream {
+
+/**
+ * Severity of a log record; records below the configured level are
+ * discarded by the writer before anything is copied
+ */
+enum class LogLevel : uint8_t {
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR,
+    OFF
+};
+
+const char* log_level_name(LogLevel level);
+
+// Parse "debug", "info", "warn", "error" or "off"
+bool parse_log_level(const std::string& name, LogLevel& level);
+
+/**
+ * What happened; the parent turns it into text when draining
+ */
+enum class LogEvent : uint16_t {
+    WORKER_STARTED,
+    WORKER_SPAWNED,
+    WORKER_SHUTDOWN,
+    WORKER_RETIRED,
+    WORKER_TERMINATED,
+    WORKER_EXITING,
+    WORKER_DIED,
+    WORKER_HUNG,
+    UNIT_ABANDONED,
+    FORK_FAILED,
+    TASK_STARTED,
+    TASK_COMPLETED,
+    TASK_FAILED,
+    RECORDS_DROPPED
+};
+
+/**
+ * Fixed-size binary log record (two cache lines)
+ * Arguments are raw integers, text is an optional truncated path
+ */
+struct LogRecord {
+    static constexpr size_t TEXT_BYTES = 88;
+    
+    uint64_t timestamp_ns;
+    uint64_t args[3];
+    int32_t worker_id;
+    LogEvent event;
+    LogLevel level;
+    uint8_t reserved;
+    char text[TEXT_BYTES];      // NUL-terminated, keeps the tail of long paths
+};
+
+static_assert(sizeof(LogRecord) == 128, "LogRecord must stay two cache lines");
+
+/**
+ * Per-worker binary event log in anonymous shared memory
+ * Each worker slot owns a single-producer/single-consumer ring: the worker
+ * appends records with plain stores (no formatting, no locks, no syscalls)
+ * and the parent drains all rings, orders records by time and writes them
+ * with one flush. A full ring drops records and counts them instead of
+ * blocking the worker
+ */
+class EventLog {
+public:
+    static constexpr size_t RING_RECORDS = 256;
+    
+    EventLog(size_t rings, LogLevel level = LogLevel::INFO);
+    
+    // Non-copyable
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+    
+    LogLevel level() const { return level_; }
+    bool enabled(LogLevel level) const { return level >= level_; }
+    
+    // Worker side: append to the ring of the given slot
+    void record(size_t ring, LogLevel level, LogEvent event, int32_t worker_id,
+                uint64_t a = 0, uint64_t b = 0, uint64_t c = 0,
+                const std::string* text = nullptr);
+    
+    // Parent side: format and write an event immediately, after pending records
+    void emit(LogLevel level, LogEvent event, int32_t worker_id,
+              uint64_t a = 0, uint64_t b = 0, uint64_t c = 0,
+              const std::string& text = std::string());
+    
+    // Parent side: write out everything the workers have logged so far
+    size_t drain();
+
+private:
+    struct alignas(64) Ring {
+        alignas(64) uint64_t head;      // Next record to write (worker)
+        uint64_t dropped;               // Records lost to a full ring (worker)
+        alignas(64) uint64_t tail;      // Next record to read (parent)
+        alignas(64) LogRecord records[RING_RECORDS];
+    };
+    
+    SharedMemory shm_;
+    Ring* rings_;
+    size_t ring_count_;
+    LogLevel level_;
+    uint64_t epoch_ns_;
+    std::vector<uint64_t> reported_dropped_;
+    
+    static void fill(LogRecord& record, LogLevel level, LogEvent event, int32_t worker_id,
+                     uint64_t a, uint64_t b, uint64_t c, const std::string* text);
+    void write(const std::vector<LogRecord>& records) const;
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_EVENT_LOG_HPP
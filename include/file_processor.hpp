@@ -3,6 +3,8 @@
 
 #include "crypto.hpp"
 #include "task_queue.hpp"
+#include "page_buffer.hpp"
+#include "memory_budget.hpp"
 #include <fstream>
 #include <vector>
 #include <memory>
@@ -18,22 +20,119 @@ class FileProcessor {
 public:
     FileProcessor() = default;
     
-    // Process a single file (encrypt or decrypt)
-    static bool process_file(const Task& task);
+    // Process a single file (encrypt or decrypt). With a budget, the data
+    // buffer is reserved under holder first, or the task runs chunked
+    static bool process_file(const TaskSpec& task, MemoryBudget* budget = nullptr,
+                             size_t holder = 0);
+    
+    // Stream the task through one chunk_bytes buffer: read, XOR, write
+    // (into output_path when given, e.g. a durable temp file)
+    static bool process_chunked(const TaskSpec& task, std::ifstream&& input,
+                                size_t chunk_bytes, const std::string& output_path = "");
+    
+    // O_DIRECT pass through an aligned buffer from the worker's BufferPool,
+    // chunk_bytes at a time. The unaligned tail is written as a padded block
+    // and the file truncated back. Clears supported, with nothing written,
+    // when the filesystem or the task's offsets rule O_DIRECT out
+    static bool process_direct(const TaskSpec& task, const std::string& output_path,
+                               size_t chunk_bytes, bool& supported);
+    
+    // Sparse pass: only the input's data extents (SEEK_DATA/SEEK_HOLE) are
+    // read, and SPARSE_BLOCK blocks that are all zero are left as holes in
+    // the output instead of written. Zero maps to a hole both ways, so the
+    // same pass encrypts and decrypts. Clears supported, with nothing
+    // written, for a range that does not start on a block boundary
+    static bool process_sparse(const TaskSpec& task, const std::string& output_path,
+                               size_t chunk_bytes, bool& supported);
+    
+    static constexpr size_t SPARSE_BLOCK = 4096;
+    
+    // Sparse ciphertext is not the plain format (zero blocks stay holes
+    // instead of keystream), so encrypting tags it with this xattr and a
+    // plain decrypt refuses tagged input
+    static constexpr const char* SPARSE_MARK = "user.cryptstream.sparse";
+    static bool sparse_marked(const std::string& path);
+    static void clear_sparse_mark(const std::string& path);
+    
+    // True when every byte is zero (SSE2 where available)
+    static bool all_zero(const uint8_t* data, size_t size);
     
     // Read file into buffer
     static std::vector<uint8_t> read_file(std::ifstream&& input);
     
-    // Write buffer to file
-    static void write_file(std::ofstream&& output, const std::vector<uint8_t>& data);
+    // Write buffer to file and close it; false if any byte failed to land
+    static bool write_file(std::ofstream&& output, const std::vector<uint8_t>& data);
+    
+    // Read file into a page buffer, huge-page backed when requested
+    static PageBuffer read_file(std::ifstream&& input, bool huge_pages);
+    
+    // Read length bytes starting at offset into a page buffer
+    static PageBuffer read_range(std::ifstream&& input, uint64_t offset,
+                                 uint64_t length, bool huge_pages);
+    
+    // Write page buffer to file and close it; false on a short write
+    static bool write_file(std::ofstream&& output, const PageBuffer& data);
+    
+    // Write buffer at offset into an existing, pre-sized file and close it;
+    // false on a short write
+    static bool write_range(std::fstream&& output, uint64_t offset, const PageBuffer& data);
+    
+    // Compressed stream: a "CSZ1" header with the chunk size, then one frame
+    // per chunk of input: raw length, stored length (top bit = stored
+    // uncompressed), payload. Payloads are encrypted with the key stream
+    // seeked to the chunk's raw offset, so every frame decodes on its own
+    // Decoding takes chunk sizes up to COMPRESS_CHUNK_BYTES only: that is
+    // what the budget reserves, so a foreign header cannot inflate buffers
+    static constexpr size_t COMPRESS_CHUNK_BYTES = 1024 * 1024;
+    
+    // Bytes of buffers the compressed path holds per task
+    static size_t compress_buffer_bytes();
+    
+    // Encrypt: compress + encrypt into frames. Decrypt: decrypt + expand them
+    static bool process_compressed(const TaskSpec& task, std::ifstream&& input,
+                                   const std::string& output_path);
+    
+    // Where a durable whole-file task writes before its commit:
+    // ".<name>.cryptstream-tmp" next to the output
+    static std::string durable_temp_path(const std::string& output);
+    
+    // Group commit of durable outputs: one syncfs per filesystem (fsync for a
+    // single file), rename each temp file over its output, then fsync the
+    // parent directories. Returns one flag per output; failed temps are removed
+    static std::vector<bool> commit_durable(const std::vector<std::string>& outputs);
+    
+    // Commit the durable whole-file tasks of a unit that succeeded; clears
+    // results of those that fail to commit and removes temps of failed tasks
+    static void commit_durable(const std::vector<TaskSpec>& tasks, std::vector<bool>& results);
+    
+    // Start reading a task's input into the page cache ahead of use
+    // (POSIX_FADV_WILLNEED, whole files capped at PREFETCH_MAX_BYTES)
+    static void prefetch_input(const TaskSpec& task);
+    
+    // Drop a finished task's input range from the page cache
+    static void drop_input_cache(const TaskSpec& task);
+    
+    // Start writeback of a task's output range and drop its clean pages;
+    // pages still under writeback go on a later call
+    static void drop_output_cache(const TaskSpec& task);
+    
+    static constexpr uint64_t PREFETCH_MAX_BYTES = 16 * 1024 * 1024;
+    
+    // Page backing used for the most recent task in this process
+    static PageMode last_page_mode() { return last_page_mode_; }
     
     // Get file size
     static size_t get_file_size(const std::string& filepath);
     
+    // Both paths name one existing file (same device and inode)
+    static bool same_file(const std::string& a, const std::string& b);
+
 private:
     static constexpr size_t BUFFER_SIZE = 8192;  // 8KB buffer
+    
+    static PageMode last_page_mode_;
 };
-
+    
 } // namespace cryptstream
 
 #endif // CRYPTSTREAM_FILE_PROCESSOR_HPP
@@ -0,0 +1,28 @@
+#ifndef CRYPTSTREAM_HEARTBEAT_HPP
+#define CRYPTSTREAM_HEARTBEAT_HPP
+
+#include <cstdint>
+
+namespace cryptstream {
+
+/**
+ * Liveness stamp of the current worker process
+ * The pool points it at the worker's slot (a remote worker at a local
+ * counter); chunk loops and throttle sleeps call beat(), so a task that is
+ * slow but progressing is not mistaken for a hung one
+ */
+class Heartbeat {
+public:
+    // Route beat() to stamp_ns (CLOCK_MONOTONIC); nullptr detaches
+    static void attach(uint64_t* stamp_ns);
+    
+    // Record progress now; free when detached
+    static void beat();
+
+private:
+    static uint64_t* stamp_;
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_HEARTBEAT_HPP
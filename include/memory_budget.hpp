@@ -0,0 +1,78 @@
+#ifndef CRYPTSTREAM_MEMORY_BUDGET_HPP
+#define CRYPTSTREAM_MEMORY_BUDGET_HPP
+
+#include "shared_memory.hpp"
+#include "task_queue.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+
+namespace cryptstream {
+
+/**
+ * Pool-wide data buffer budget (a byte-counting semaphore)
+ * Lives in an anonymous shared mapping inherited by the workers. A worker
+ * reserves the bytes of its data buffer before allocating and releases them
+ * after writing; tasks that cannot get their whole size stream through a
+ * chunk-sized reservation instead. Reservations are tracked per holder
+ * (worker slot) so the parent can reclaim those of a crashed worker
+ */
+class MemoryBudget {
+public:
+    static constexpr size_t MAX_HOLDERS = TaskQueue::MAX_LEASES;
+    static constexpr uint64_t DEFAULT_CHUNK_BYTES = 1024 * 1024;
+    
+    // capacity 0 = default_capacity(); chunk_bytes is capped to the capacity
+    MemoryBudget(uint64_t capacity, uint64_t chunk_bytes = DEFAULT_CHUNK_BYTES);
+    ~MemoryBudget();
+    
+    // Non-copyable
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+    
+    // Half of physical memory
+    static uint64_t default_capacity();
+    
+    uint64_t capacity() const { return state_->capacity; }
+    uint64_t chunk_bytes() const { return state_->chunk_bytes; }
+    uint64_t in_use() const;
+    uint64_t available() const;
+    uint64_t peak() const;
+    uint64_t chunked_tasks() const;
+    
+    // Reserve bytes without waiting; false if they do not fit right now
+    bool try_acquire(size_t holder, uint64_t bytes);
+    
+    // Reserve bytes, waiting for releases; requests above capacity are clamped
+    uint64_t acquire(size_t holder, uint64_t bytes);
+    
+    void release(size_t holder, uint64_t bytes);
+    
+    // Drop everything a dead holder still had reserved; returns the bytes
+    uint64_t release_all(size_t holder);
+    
+    // Count a task that fell back to chunked processing
+    void count_chunked();
+
+private:
+    struct State {
+        pthread_mutex_t mutex;
+        pthread_cond_t released;
+        uint64_t capacity;
+        uint64_t chunk_bytes;
+        uint64_t in_use;
+        uint64_t peak;
+        uint64_t chunked_tasks;
+        uint64_t held[MAX_HOLDERS];
+    };
+    
+    SharedMemory shm_;
+    State* state_;
+    SharedMutex mutex_;
+    
+    bool reserve_locked(size_t holder, uint64_t bytes);
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_MEMORY_BUDGET_HPP
@@ -0,0 +1,62 @@
+#ifndef CRYPTSTREAM_PAGE_BUFFER_HPP
+#define CRYPTSTREAM_PAGE_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cryptstream {
+
+/**
+ * Page backing that actually took effect for a mapping
+ */
+enum class PageMode {
+    STANDARD,           // Regular 4 KB pages
+    TRANSPARENT_HUGE,   // madvise(MADV_HUGEPAGE), kernel THP enabled
+    HUGETLB_2MB,        // MAP_HUGETLB / hugetlbfs, 2 MB pages
+    HUGETLB_1GB         // MAP_HUGETLB | MAP_HUGE_1GB
+};
+
+const char* page_mode_name(PageMode mode);
+
+// Check whether the kernel honours MADV_HUGEPAGE for anonymous or shmem memory
+bool transparent_huge_pages_available(bool shmem);
+
+static constexpr size_t HUGE_PAGE_SIZE = 2UL * 1024 * 1024;
+static constexpr size_t GIGANTIC_PAGE_SIZE = 1024UL * 1024 * 1024;
+
+/**
+ * Process-private data buffer for file contents
+ * Optionally backed by huge pages to cut TLB misses on large XOR passes:
+ * tries MAP_HUGETLB first, then falls back to MADV_HUGEPAGE, then 4 KB pages
+ */
+class PageBuffer {
+public:
+    PageBuffer() = default;
+    PageBuffer(size_t size, bool huge_pages);
+    ~PageBuffer();
+    
+    // Move-only
+    PageBuffer(PageBuffer&& other) noexcept;
+    PageBuffer& operator=(PageBuffer&& other) noexcept;
+    PageBuffer(const PageBuffer&) = delete;
+    PageBuffer& operator=(const PageBuffer&) = delete;
+    
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    
+    // Page backing that took effect
+    PageMode mode() const { return mode_; }
+    
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t mapped_size_ = 0;   // Non-zero when allocated with mmap
+    PageMode mode_ = PageMode::STANDARD;
+    
+    void release();
+};
+
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_PAGE_BUFFER_HPP
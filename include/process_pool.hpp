@@ -3,7 +3,14 @@
 
 #include "task_queue.hpp"
 #include "shared_memory.hpp"
+#include "event_log.hpp"
+#include "trace.hpp"
+#include "memory_budget.hpp"
+#include "throttle.hpp"
+#include <memory>
 #include <vector>
+#include <cstdint>
+#include <signal.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -11,21 +18,72 @@ namespace cryptstream {
 
 /**
  * Lazy process pool for parallel task execution
- * Creates child processes on-demand and manages their lifecycle
+ * Creates child processes on-demand as queue depth and measured task time
+ * justify it (up to max_processes), and lets workers idle for longer than
+ * idle_timeout_ms retire down to min_processes
+ *
+ * Supervised: every dequeued unit is leased to the worker's slot; when a
+ * worker dies (SIGCHLD wakes the producer) or stops heartbeating past
+ * lease_timeout_ms, its unit is requeued and a replacement is spawned
+ *
+ * Workers log through per-slot binary rings; the parent formats and writes
+ * them whenever it supervises, so the task path never touches stdout
+ *
+ * Data buffers are admitted against a shared MemoryBudget: workers reserve
+ * before allocating, and no worker is forked while the budget cannot fit
+ * even one chunk
+ *
+ * The first reserved_workers slots serve only the high priority class:
+ * they wait on the urgent semaphore, never retire, and are respawned as
+ * soon as their slot is free, so an urgent unit finds an idle worker even
+ * while every other worker is busy with bulk work
  */
 class ProcessPool {
 public:
+    struct Options {
+        size_t min_processes = 1;
+        size_t max_processes = 4;
+        unsigned int idle_timeout_ms = 0;   // 0 = idle workers never retire
+        unsigned int lease_timeout_ms = 0;  // 0 = no hung-worker detection
+        LogLevel log_level = LogLevel::INFO;
+        bool trace = false;                 // Record per-stage task spans
+        uint64_t memory_budget = 0;         // Data buffer bytes; 0 = half of RAM
+        uint64_t chunk_bytes = MemoryBudget::DEFAULT_CHUNK_BYTES;
+        size_t prefetch_depth = 4;          // Queued inputs to read ahead; 0 = off
+        bool drop_cache = true;             // DONTNEED finished inputs and outputs
+        size_t reserved_workers = 0;        // High-class only, within max_processes
+        Throttle* throttle = nullptr;       // Shared I/O limits charged by workers
+    };
+    
     ProcessPool(size_t num_processes, TaskQueue& queue, 
                 Semaphore& task_sem, Semaphore& done_sem);
+    
+    // urgent_sem is posted once per high-class unit; required for reserved workers
+    ProcessPool(const Options& options, TaskQueue& queue,
+                Semaphore& task_sem, Semaphore& done_sem,
+                Semaphore* urgent_sem = nullptr);
     ~ProcessPool();
     
     // Non-copyable
     ProcessPool(const ProcessPool&) = delete;
     ProcessPool& operator=(const ProcessPool&) = delete;
     
-    // Start worker processes
+    // Start the minimum number of worker processes
     void start();
     
+    // Spawn workers for queued work without an idle worker; reap retired ones
+    void scale();
+    
+    // Reap exited workers, requeue units leased to dead or hung workers
+    // and spawn replacements
+    void supervise();
+    
+    // Write out worker log records collected so far
+    void drain_log() { log_.drain(); }
+    
+    // Wake every live worker after queue shutdown has been signalled
+    void signal_workers();
+    
     // Wait for all workers to complete
     void wait_all();
     
@@ -33,21 +91,88 @@ public:
     void terminate();
     
     // Get number of active workers
-    size_t active_workers() const { return worker_pids_.size(); }
+    size_t active_workers() const;
+    
+    // Most workers alive at once
+    size_t peak_workers() const { return peak_workers_; }
+    
+    // Workers that died abnormally or were killed as hung
+    size_t crashed_workers() const { return crashed_workers_; }
+    
+    // Leased units put back on the queue
+    size_t requeued_units() const { return requeued_units_; }
+    
+    // Mean measured processing time per task, 0 until a task completes
+    double average_task_ms() const;
+    
+    // Shared data buffer budget
+    const MemoryBudget& budget() const { return budget_; }
     
+    // Spans recorded by the workers, null unless Options::trace
+    const TraceBuffer* trace() const { return trace_.get(); }
+
 private:
-    size_t num_processes_;
+    static constexpr size_t MAX_WORKERS = TaskQueue::MAX_LEASES;
+    
+    // How often an idle worker checks that its parent is still alive
+    static constexpr unsigned int ORPHAN_CHECK_MS = 1000;
+    
+    /**
+     * Per-worker state; the slot index doubles as the worker's lease slot
+     */
+    struct WorkerSlot {
+        pid_t pid;              // 0 = free, -1 = being forked
+        uint32_t idle;
+        uint64_t heartbeat_ns;
+    };
+    
+    /**
+     * Counters shared with workers through an anonymous mapping
+     */
+    struct PoolControl {
+        size_t live_workers;
+        uint64_t tasks_done;
+        uint64_t busy_ns;
+        WorkerSlot slots[MAX_WORKERS];
+    };
+    
+    Options options_;
     TaskQueue& queue_;
     Semaphore& task_sem_;
     Semaphore& done_sem_;
-    std::vector<pid_t> worker_pids_;
+    Semaphore* urgent_sem_;
+    SharedMemory control_shm_;
+    PoolControl* control_;
+    EventLog log_;
+    MemoryBudget budget_;
+    std::unique_ptr<TraceBuffer> trace_;
+    pid_t parent_pid_;
+    int next_worker_id_;
+    size_t peak_workers_;
+    size_t crashed_workers_;
+    size_t requeued_units_;
+    uint64_t fork_ns_total_;
+    uint64_t forks_;
     bool started_;
+    struct sigaction previous_sigchld_;
+    
+    // Fork into the lowest free general slot, or into the given slot
+    bool spawn_worker();
+    bool spawn_worker(size_t slot);
+    void fill_reserved();
+    bool is_reserved(size_t slot) const { return slot < options_.reserved_workers; }
+    void handle_exit(size_t slot, int status);
+    
+    // Idle general workers, the ones that can take any class
+    size_t idle_workers() const;
     
     // Worker process main loop
-    static void worker_loop(int worker_id, TaskQueue& queue, 
-                           Semaphore& task_sem, Semaphore& done_sem);
+    void worker_loop(int worker_id, size_t slot);
+    
+    // Leave the pool if more than min_processes workers remain
+    bool try_retire();
 };
-
+    
 } // namespace cryptstream
 
 #endif // CRYPTSTREAM_PROCESS_POOL_HPP
@@ -0,0 +1,74 @@
+#ifndef CRYPTSTREAM_SCHEDULER_HPP
+#define CRYPTSTREAM_SCHEDULER_HPP
+
+#include "task_queue.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace cryptstream {
+
+/**
+ * Size-aware batch scheduler in front of the FIFO TaskQueue
+ * Splits giant files into byte ranges, packs small files into bundles
+ * and orders the resulting work units longest-processing-time first
+ */
+class Scheduler {
+public:
+    struct Options {
+        size_t num_workers = 4;
+        uint64_t min_split_bytes = 1024 * 1024;     // Never split below 1 MB ranges
+        uint64_t small_file_bytes = 64 * 1024;      // Files below this get packed
+        size_t max_pack_files = TaskQueue::MAX_BUNDLE;  // Files per packed bundle
+        double bytes_per_ms = 500.0 * 1024;         // Cost model: throughput
+        double task_overhead_ms = 0.05;             // Cost model: per-task overhead
+        uint64_t memory_budget = 0;                 // Cap ranges so all workers fit; 0 = none
+    };
+    
+    /**
+     * One dequeue unit: a single task, a file range, or a packed bundle
+     */
+    struct WorkUnit {
+        std::vector<TaskSpec> tasks;
+        uint64_t bytes = 0;
+        double cost_ms = 0.0;
+    };
+    
+    explicit Scheduler(const Options& options);
+    
+    // Add a file job; its size is taken from the filesystem
+    void add(TaskSpec::Type type, const std::string& input, const std::string& output);
+    
+    // Build work units ordered largest-first, pre-sizing outputs of split files
+    std::vector<WorkUnit> plan(const std::string& key, uint32_t flags);
+    
+    // Makespan predicted by LPT list scheduling over num_workers
+    double predicted_makespan_ms() const { return predicted_makespan_ms_; }
+    
+    // Lower bound: max(total work / workers, largest unit)
+    double lower_bound_ms() const { return lower_bound_ms_; }
+    
+    size_t file_count() const { return jobs_.size(); }
+    uint64_t total_bytes() const { return total_bytes_; }
+
+private:
+    struct Job {
+        TaskSpec::Type type;
+        std::string input;
+        std::string output;
+        uint64_t size;
+    };
+    
+    Options options_;
+    std::vector<Job> jobs_;
+    uint64_t total_bytes_;
+    double predicted_makespan_ms_;
+    double lower_bound_ms_;
+    
+    double cost(uint64_t bytes, size_t tasks) const;
+    void predict(const std::vector<WorkUnit>& units);
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_SCHEDULER_HPP
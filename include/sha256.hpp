@@ -0,0 +1,44 @@
+#ifndef CRYPTSTREAM_SHA256_HPP
+#define CRYPTSTREAM_SHA256_HPP
+
+#include <array>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace cryptstream {
+
+/**
+ * SHA-256 (FIPS 180-4) and HMAC-SHA-256 (RFC 2104)
+ * Self-contained, for authenticating cluster peers; not on the data path
+ */
+class Sha256 {
+public:
+    static constexpr size_t DIGEST_BYTES = 32;
+    static constexpr size_t BLOCK_BYTES = 64;
+    using Digest = std::array<uint8_t, DIGEST_BYTES>;
+    
+    Sha256();
+    
+    void update(const uint8_t* data, size_t size);
+    void update(const std::string& data);
+    Digest finish();
+    
+    static Digest hash(const std::string& data);
+    static Digest hmac(const std::string& key, const std::string& message);
+    
+    // Compare without an early exit, so timing does not reveal the prefix
+    static bool equal(const Digest& a, const Digest& b);
+
+private:
+    uint32_t state_[8];
+    uint8_t block_[BLOCK_BYTES];
+    size_t used_;           // Bytes buffered in block_
+    uint64_t length_;       // Total bytes hashed
+    
+    void compress(const uint8_t* block);
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_SHA256_HPP
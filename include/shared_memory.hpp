@@ -1,7 +1,9 @@
 #ifndef CRYPTSTREAM_SHARED_MEMORY_HPP
 #define CRYPTSTREAM_SHARED_MEMORY_HPP
 
+#include "page_buffer.hpp"
 #include <string>
+#include <vector>
 #include <cstddef>
 #include <sys/mman.h>
 #include <fcntl.h>
@@ -11,13 +13,42 @@
 
 namespace cryptstream {
 
+/**
+ * Per-run IPC names
+ * Each run names its objects "<prefix>.<pid>.<nonce>_<object>", so any
+ * number of concurrent jobs can share a host. The creator of a named
+ * segment holds a shared flock on it, inherited by forked workers; a run
+ * whose "_queue" segment is missing or unlocked has no live process left
+ */
+static constexpr const char* SHM_DIRECTORY = "/dev/shm";
+
+// Fresh run name under prefix, unique among live runs on the host
+std::string unique_ipc_name(const std::string& prefix);
+
+// Remove segments and semaphores of dead runs under prefix (left behind
+// by crashes); returns the number of objects removed
+size_t remove_stale_ipc(const std::string& prefix);
+
+// Names ("<prefix>.<pid>.<nonce>") of the live runs a process started
+std::vector<std::string> live_ipc_runs(const std::string& prefix, pid_t pid);
+
 /**
  * Shared memory region using mmap
  * Provides true memory sharing across processes (no copy-on-write)
+ * With huge_pages, the segment is placed on hugetlbfs when mounted,
+ * otherwise the shm_open mapping is advised with MADV_HUGEPAGE
  */
 class SharedMemory {
 public:
-    SharedMemory(const std::string& name, size_t size, bool create = true);
+    static constexpr const char* HUGETLBFS_MOUNT = "/dev/hugepages";
+    
+    // With create, the name must not exist yet; the segment stays flocked
+    // until the last process holding it exits
+    SharedMemory(const std::string& name, size_t size, bool create = true,
+                 bool huge_pages = false);
+    
+    // Anonymous shared mapping, inherited by children across fork()
+    explicit SharedMemory(size_t size);
     ~SharedMemory();
     
     // Non-copyable
@@ -30,15 +61,23 @@ public:
     // Get size of shared memory
     size_t size() const { return size_; }
     
+    // Page backing that took effect for the segment
+    PageMode page_mode() const { return page_mode_; }
+    
     // Unlink shared memory (call from parent process)
     void unlink();
     
 private:
     std::string name_;
+    std::string hugetlb_path_;  // Non-empty when backed by hugetlbfs
     void* ptr_;
     size_t size_;
+    size_t mapped_size_;
     int fd_;
     bool owner_;
+    PageMode page_mode_;
+    
+    bool map_hugetlbfs(bool create);
 };
 
 /**
@@ -46,6 +85,7 @@ private:
  */
 class Semaphore {
 public:
+    // With create, fails if the name exists rather than taking it over
     Semaphore(const std::string& name, unsigned int initial_value, bool create = true);
     ~Semaphore();
     
@@ -57,6 +97,9 @@ public:
     void post();
     bool try_wait();
     
+    // Wait up to timeout_ms; false on timeout or signal interruption
+    bool timed_wait(unsigned int timeout_ms);
+    
     void unlink();
     
 private:
@@ -67,6 +110,8 @@ private:
 
 /**
  * POSIX mutex in shared memory for process synchronization
+ * Robust: if the owner dies while holding it, the next locker takes it
+ * over instead of deadlocking
  */
 class SharedMutex {
 public:
@@ -79,6 +124,9 @@ public:
     
 private:
     pthread_mutex_t* mutex_;
+    
+    // Handle a pthread lock result; true when the lock is now held
+    bool acquired(int result);
 };
 
 } // namespace cryptstream
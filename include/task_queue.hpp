@@ -3,75 +3,238 @@
 
 #include "shared_memory.hpp"
 #include <string>
+#include <vector>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 
 namespace cryptstream {
 
 /**
- * Task structure for encryption/decryption operations
- * Stored directly in shared memory (no pointers!)
+ * Task specification for encryption/decryption operations
+ * Process-local form with owned strings; paths and keys of any length
  */
-struct Task {
-    enum Type { ENCRYPT, DECRYPT, TERMINATE };
+struct TaskSpec {
+    enum Type : uint8_t { ENCRYPT, DECRYPT, TERMINATE };
+    
+    // Dequeue classes, most urgent first
+    enum Priority : uint8_t { PRIORITY_HIGH, PRIORITY_NORMAL, PRIORITY_BULK };
+    
+    // Per-task processing options
+    enum Flags : uint32_t {
+        FLAG_HUGE_PAGES = 1u << 0,   // Back the data buffer with huge pages
+        FLAG_DURABLE = 1u << 1,      // Write a temp file, group-commit, rename
+        FLAG_COMPRESS = 1u << 2,     // LZ-compress chunks before encrypting
+        FLAG_DIRECT = 1u << 3,       // O_DIRECT I/O, bypassing the page cache
+        FLAG_PACK = 1u << 4,         // Append to an archive segment (output = archive)
+        FLAG_SPARSE = 1u << 5        // Skip holes and zero blocks, leaving holes
+    };
+    
+    Type type = TERMINATE;
+    std::string input_file;
+    std::string output_file;
+    std::string key;
+    uint32_t flags = 0;
+    uint64_t offset = 0;    // Byte range start (range tasks)
+    uint64_t length = 0;    // Byte range length, 0 = whole file
+    uint64_t tag = 0;       // Caller's job id; non-zero tags report completions
+    uint64_t enqueued_ns = 0;   // CLOCK_MONOTONIC submit time; 0 = stamped on enqueue
+    Priority priority = PRIORITY_NORMAL;
+};
+
+const char* priority_name(TaskSpec::Priority priority);
+
+/**
+ * Compact task descriptor stored in the shared memory ring
+ * One cache line; paths live in the queue's string arena and keys in its
+ * key-slot table, referenced by offset/index (no pointers!)
+ */
+struct alignas(64) Task {
+    using Type = TaskSpec::Type;
+    static constexpr Type ENCRYPT = TaskSpec::ENCRYPT;
+    static constexpr Type DECRYPT = TaskSpec::DECRYPT;
+    static constexpr Type TERMINATE = TaskSpec::TERMINATE;
     
     Type type;
-    char input_file[256];
-    char output_file[256];
-    char key[64];
     bool completed;
-    int worker_id;
-    
-    Task() : type(TERMINATE), completed(false), worker_id(-1) {
-        input_file[0] = '\0';
-        output_file[0] = '\0';
-        key[0] = '\0';
-    }
-    
-    void set_input(const std::string& path) {
-        std::strncpy(input_file, path.c_str(), sizeof(input_file) - 1);
-        input_file[sizeof(input_file) - 1] = '\0';
-    }
-    
-    void set_output(const std::string& path) {
-        std::strncpy(output_file, path.c_str(), sizeof(output_file) - 1);
-        output_file[sizeof(output_file) - 1] = '\0';
-    }
-    
-    void set_key(const std::string& k) {
-        std::strncpy(key, k.c_str(), sizeof(key) - 1);
-        key[sizeof(key) - 1] = '\0';
-    }
+    uint16_t key_slot;      // Index into the key-slot table
+    uint32_t flags;
+    uint32_t input_ref;     // Arena offset of NUL-terminated input path
+    uint32_t output_ref;    // Arena offset of NUL-terminated output path
+    uint32_t bundle_size;   // Tasks left in this bundle, including this one
+    uint64_t offset;
+    uint64_t length;
+    uint64_t tag;
+    int32_t worker_id;
+    uint8_t priority;       // Ring the task is queued in
+    uint8_t requeues;       // Times its unit was taken back from a dead worker
+    uint64_t enqueued_ns;
+    
+    Task() : type(TERMINATE), completed(false), key_slot(0), flags(0),
+             input_ref(0), output_ref(0), bundle_size(1), offset(0), length(0),
+             tag(0), worker_id(-1), priority(TaskSpec::PRIORITY_NORMAL), requeues(0),
+             enqueued_ns(0) {}
 };
 
+static_assert(sizeof(Task) == 64, "Task descriptor must fit one cache line");
+
 /**
- * Circular task queue in shared memory
- * Thread-safe, lock-free for single producer/consumer
+ * Circular task queues in shared memory, one ring per priority class
+ * Any number of producer and worker processes: every operation runs under
+ * one process-shared robust mutex (SharedMutex), so a holder that dies
+ * hands the lock on instead of wedging the queue
  * Uses array-based storage to avoid pointer issues in shared memory
+ *
+ * Workers pick the ring by smooth weighted round-robin over the non-empty
+ * classes, so urgent units go first without starving bulk work. Part of
+ * the string arena is kept for the high class, so a full bulk backlog
+ * never keeps an urgent unit out
  */
 class TaskQueue {
 public:
-    static constexpr size_t MAX_TASKS = 128;
+    static constexpr size_t PRIORITY_CLASSES = 3;
+    static constexpr size_t MAX_TASKS = 1024;      // Per priority class
+    static constexpr size_t ARENA_BYTES = 256 * 1024;
+    static constexpr size_t MAX_KEYS = 16;
+    static constexpr size_t MAX_KEY_BYTES = 256;   // Crypto expands keys to 256 bytes
+    static constexpr size_t MAX_BUNDLE = 32;       // Tasks per enqueued unit
+    static constexpr size_t MAX_LEASES = 64;       // Worker lease slots
+    static constexpr size_t HIGH_ARENA_BYTES = 32 * 1024;  // Arena only the high class uses
+    static constexpr size_t WAIT_BUCKETS = 32;     // Power-of-two microsecond buckets
+    static constexpr uint8_t MAX_REQUEUES = 3;     // Then a unit that keeps killing workers fails
+    
+    // Dequeue shares when every class has work: high, normal, bulk
+    static constexpr uint32_t DEFAULT_WEIGHTS[PRIORITY_CLASSES] = {16, 4, 1};
+    
+    // Every queued or leased task can have a completion waiting to be drained
+    static constexpr size_t MAX_COMPLETIONS = MAX_TASKS * PRIORITY_CLASSES +
+                                              MAX_LEASES * MAX_BUNDLE;
     
     /**
-     * Shared memory layout for the queue
+     * Per-task outcome for tagged tasks, drained by the producer
      */
-    struct QueueData {
-        pthread_mutex_t mutex;
+    struct Completion {
+        uint64_t tag;
+        uint32_t success;
+        uint32_t reserved;
+    };
+    
+    /**
+     * Key-slot table entry, shared by all tasks using the same key
+     */
+    struct KeySlot {
+        uint32_t length;
+        char bytes[MAX_KEY_BYTES];
+    };
+    
+    /**
+     * Descriptors of the unit a worker is processing
+     * Written in the same critical section as the dequeue, so a task is
+     * always either queued or leased, and a dead worker's unit can be requeued
+     */
+    struct Lease {
+        uint32_t count;
+        Task tasks[MAX_BUNDLE];
+    };
+    
+    /**
+     * Queue wait of dequeued units, submit to dequeue, for one class
+     */
+    struct WaitStats {
+        uint64_t units;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        uint64_t buckets[WAIT_BUCKETS];     // Bucket b: below 2^(b+1) microseconds
+        
+        double mean_ms() const;
+        
+        // Upper bound of the bucket holding the q-quantile (0 < q <= 1)
+        double percentile_ms(double q) const;
+    };
+    
+    struct Ring {
         size_t head;
         size_t tail;
         size_t count;
+    };
+    
+    /**
+     * Shared memory layout for the queue
+     */
+    struct QueueData {
+        pthread_mutex_t mutex;
+        Ring rings[PRIORITY_CLASSES];
+        size_t count;           // Tasks queued across all rings
         bool shutdown;
-        Task tasks[MAX_TASKS];
+        size_t succeeded;
+        size_t failed;
+        size_t completed_units;
+        
+        // Append-only string arena, rewound once the queue has drained
+        size_t arena_used;
+        size_t leased;          // Tasks held in leases
+        size_t keys_used;
+        size_t completion_head;
+        size_t completion_count;
+        
+        // Weighted round-robin state and per-class latency
+        uint32_t weights[PRIORITY_CLASSES];
+        int64_t credits[PRIORITY_CLASSES];
+        WaitStats waits[PRIORITY_CLASSES];
+        
+        Task tasks[PRIORITY_CLASSES][MAX_TASKS];
+        Lease leases[MAX_LEASES];
+        Completion completions[MAX_COMPLETIONS];
+        KeySlot keys[MAX_KEYS];
+        char arena[ARENA_BYTES];
     };
     
     TaskQueue(SharedMemory& shm, bool initialize = false);
     
+    // Dequeue shares per class; zero weights are raised to one
+    void set_weights(const uint32_t weights[PRIORITY_CLASSES]);
+    
     // Producer operations
-    bool enqueue(const Task& task);
+    bool enqueue(const TaskSpec& task);
+    
+    // Enqueue several tasks as one unit, dequeued together by a single
+    // worker, into the ring of the first task's priority
+    bool enqueue_bundle(const std::vector<TaskSpec>& tasks);
     
     // Consumer operations
-    bool dequeue(Task& task);
+    bool dequeue(TaskSpec& task);
+    
+    // Dequeue a whole bundle (a plain task is a bundle of one), leasing it
+    // to lease_slot when given; high_only takes only from the high ring
+    bool dequeue_bundle(std::vector<TaskSpec>& tasks, int lease_slot = -1,
+                        bool high_only = false);
+    
+    // Finish a leased unit and record per-task outcomes (one flag per task)
+    void complete_lease(int lease_slot, const std::vector<bool>& results);
+    
+    // Claim up to depth tasks at the queue head for readahead; each queued
+    // task is handed out once, with input_file, offset and length filled in
+    size_t claim_prefetch(std::vector<TaskSpec>& out, size_t depth);
+    
+    // Move all pending completions of tagged tasks into out
+    void drain_completions(std::vector<Completion>& out);
+    
+    // What requeue_lease did with a dead worker's unit
+    enum class Requeue { NONE, REQUEUED, ABANDONED };
+    
+    // Put a dead worker's leased unit back at the queue head; NONE if
+    // nothing was leased or the queue has no room yet. A unit already
+    // requeued MAX_REQUEUES times is completed as failed (ABANDONED)
+    Requeue requeue_lease(int lease_slot);
+    bool has_lease(int lease_slot) const;
+    
+    // Snapshot of one class's queue-wait latency
+    WaitStats wait_stats(TaskSpec::Priority priority) const;
+    
+    // Outcome counters, updated as leases complete
+    size_t succeeded() const;
+    size_t failed() const;
+    size_t completed_units() const;
     
     // Queue status
     bool is_empty() const;
@@ -81,12 +244,26 @@ public:
     // Shutdown signal
     void signal_shutdown();
     bool is_shutdown() const;
-    
+
 private:
+    // Task::flags bit marking a queued task whose input was already prefetched
+    static constexpr uint32_t PREFETCHED = 1u << 31;
+    
     QueueData* data_;
-    SharedMutex mutex_;
+    mutable SharedMutex mutex_;
+    
+    // Helpers below expect the mutex to be held
+    bool reserve_locked(const std::vector<TaskSpec>& tasks, size_t ring);
+    int pick_ring_locked();
+    void record_wait_locked(size_t ring, uint64_t wait_ns);
+    uint32_t intern_string_locked(const std::string& value);
+    uint16_t intern_key_locked(const std::string& key);
+    void finish_lease_locked(Lease* lease, const std::vector<bool>& results);
+    
+    // Copy a descriptor's arena strings out; expects the mutex to be held
+    void resolve(const Task& task, TaskSpec& spec) const;
 };
-
+    
 } // namespace cryptstream
 
 #endif // CRYPTSTREAM_TASK_QUEUE_HPP
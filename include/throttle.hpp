@@ -0,0 +1,87 @@
+#ifndef CRYPTSTREAM_THROTTLE_HPP
+#define CRYPTSTREAM_THROTTLE_HPP
+
+#include "shared_memory.hpp"
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+
+namespace cryptstream {
+
+/**
+ * Per-run I/O limits: token buckets for read bytes, write bytes and
+ * operations, shared by every worker through a "_throttle" segment
+ * Each bucket hands out start times at its rate (GCRA): a worker charges
+ * a chunk before its read or write and sleeps until its slot, so the
+ * workers together never exceed the limit, with up to BURST_MS of unused
+ * rate banked. Limits can be changed while the run is going, by any
+ * process that maps the segment (`cryptstream throttle <pid>`); sleepers
+ * wake within SLICE_MS of a change and the new rate applies at once
+ */
+class Throttle {
+public:
+    enum Resource : uint32_t { READ_BYTES, WRITE_BYTES, OPERATIONS, RESOURCES };
+    
+    static constexpr uint64_t BURST_MS = 100;
+    static constexpr uint64_t SLICE_MS = 50;
+    
+    /**
+     * Rates per second; 0 = unlimited
+     */
+    struct Limits {
+        uint64_t read_bytes = 0;
+        uint64_t write_bytes = 0;
+        uint64_t operations = 0;
+    };
+    
+    /**
+     * Segment layout
+     */
+    struct Bucket {
+        uint64_t rate;
+        uint64_t next_ns;           // Earliest start of the next charge
+        uint64_t throttled_ns;      // Time workers spent waiting on this bucket
+    };
+    
+    struct State {
+        pthread_mutex_t mutex;
+        uint32_t generation;        // Bumped on every limit change
+        Bucket buckets[RESOURCES];
+    };
+    
+    Throttle(SharedMemory& shm, bool initialize = false);
+    
+    void set_limits(const Limits& limits);
+    Limits limits() const;
+    
+    // Total time charges waited on one bucket
+    uint64_t throttled_ns(Resource resource) const;
+    
+    // Worker side: route this process's read()/write() charges to throttle
+    // (nullptr detaches; charges are then free)
+    static void attach(Throttle* throttle);
+    
+    // Any limit set on the attached throttle
+    static bool limited();
+    
+    // Charge one read or write of bytes, plus one operation
+    static void read(uint64_t bytes);
+    static void write(uint64_t bytes);
+    
+    // Throttle segments of the live runs started by pid under prefix
+    static std::vector<std::string> find(const std::string& prefix, pid_t pid);
+
+private:
+    State* state_;
+    mutable SharedMutex mutex_;
+    
+    static Throttle* active_;
+    
+    void take(Resource resource, uint64_t amount);
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_THROTTLE_HPP
@@ -0,0 +1,125 @@
+#ifndef CRYPTSTREAM_TRACE_HPP
+#define CRYPTSTREAM_TRACE_HPP
+
+#include "shared_memory.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <time.h>
+
+namespace cryptstream {
+
+/**
+ * Stage of a task a span measures
+ */
+enum class TraceStage : uint16_t {
+    TASK,           // Whole task inside the worker
+    QUEUE_WAIT,     // Enqueued by the producer until dequeued by a worker
+    OPEN,
+    READ,
+    CRYPTO,
+    COMPRESS,       // LZ compress or decompress of one chunk
+    WRITE,
+    COMMIT          // Durable group commit: sync and rename
+};
+
+const char* trace_stage_name(TraceStage stage);
+
+/**
+ * One completed span (32 bytes), CLOCK_MONOTONIC nanoseconds
+ */
+struct TraceSpan {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint64_t bytes;
+    int32_t worker_id;
+    TraceStage stage;
+    uint16_t reserved;
+};
+
+/**
+ * Preallocated span storage shared with the workers
+ * One fixed array per worker slot in an anonymous shared mapping; a worker
+ * appends with plain stores (a clock read plus a 32-byte write), the parent
+ * reads the arrays after the run and merges them into a Chrome trace
+ * (chrome://tracing, ui.perfetto.dev). Spans past the capacity are counted
+ * and dropped
+ */
+class TraceBuffer {
+public:
+    static constexpr size_t SPANS_PER_SLOT = 16384;
+    
+    explicit TraceBuffer(size_t slots);
+    
+    // Non-copyable
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer& operator=(const TraceBuffer&) = delete;
+    
+    // Route this process's spans into a slot (call in the worker after fork)
+    static void attach(TraceBuffer* buffer, size_t slot, int32_t worker_id);
+    static bool active() { return slot_ != nullptr; }
+    
+    // Monotonic clock for span starts; 0 when tracing is off
+    static uint64_t now() {
+        if (!slot_) {
+            return 0;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+    
+    // Record a span from start_ns until now
+    static void record(TraceStage stage, uint64_t start_ns, uint64_t bytes = 0) {
+        if (slot_) {
+            append(stage, start_ns, now(), bytes);
+        }
+    }
+    
+    // Record a span with explicit end (e.g. queue wait measured at dequeue)
+    static void record(TraceStage stage, uint64_t start_ns, uint64_t end_ns, uint64_t bytes) {
+        if (slot_) {
+            append(stage, start_ns, end_ns, bytes);
+        }
+    }
+    
+    size_t span_count() const;
+    size_t dropped() const;
+    
+    // Merge all slots into Chrome trace event JSON
+    bool write_chrome_json(const std::string& path) const;
+
+private:
+    struct Slot {
+        alignas(64) uint64_t count;
+        uint64_t dropped;
+        TraceSpan spans[SPANS_PER_SLOT];
+    };
+    
+    SharedMemory shm_;
+    Slot* slots_;
+    size_t slot_count_;
+    
+    static Slot* slot_;
+    static int32_t worker_id_;
+    
+    static void append(TraceStage stage, uint64_t start_ns, uint64_t end_ns, uint64_t bytes) {
+        uint64_t index = slot_->count;     // Single writer per slot
+        if (index >= SPANS_PER_SLOT) {
+            slot_->dropped++;
+            return;
+        }
+        TraceSpan& span = slot_->spans[index];
+        span.start_ns = start_ns;
+        span.duration_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+        span.bytes = bytes;
+        span.worker_id = worker_id_;
+        span.stage = stage;
+        span.reserved = 0;
+        __atomic_store_n(&slot_->count, index + 1, __ATOMIC_RELEASE);
+    }
+};
+    
+} // namespace cryptstream
+
+#endif // CRYPTSTREAM_TRACE_HPP
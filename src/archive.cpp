@@ -0,0 +1,459 @@
+#include "archive.hpp"
+#include "buffer_pool.hpp"
+#include "crypto.hpp"
+#include "trace.hpp"
+#include "throttle.hpp"
+#include "heartbeat.hpp"
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cryptstream {
+
+constexpr char Archive::INDEX_MAGIC[4];
+
+namespace {
+
+/**
+ * Entry in seg-NNN.list, followed by the member name; appended only after
+ * the member's bytes are in the segment
+ */
+struct ListRecord {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t name_length;
+    uint32_t reserved;
+};
+
+bool write_all(int fd, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t put = write(fd, bytes, size);
+        if (put == -1 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return false;
+        }
+        bytes += put;
+        size -= put;
+    }
+    return true;
+}
+
+bool read_whole(const std::string& path, std::vector<uint8_t>& data) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    data.resize(st.st_size);
+    bool ok = pread(fd, data.data(), data.size(), 0) == static_cast<ssize_t>(data.size());
+    close(fd);
+    return ok;
+}
+
+// Walk complete list records; returns the end of the last complete one
+template <typename Visit>
+size_t parse_list(const std::vector<uint8_t>& data, Visit visit) {
+    size_t pos = 0;
+    while (data.size() - pos >= sizeof(ListRecord)) {
+        ListRecord record;
+        std::memcpy(&record, data.data() + pos, sizeof(record));
+        if (data.size() - pos - sizeof(record) < record.name_length) {
+            break;
+        }
+        std::string name(reinterpret_cast<const char*>(data.data() + pos + sizeof(record)),
+                         record.name_length);
+        visit(record, name);
+        pos += sizeof(record) + record.name_length;
+    }
+    return pos;
+}
+
+/**
+ * The segment this process appends to, kept open across tasks
+ */
+struct OpenSegment {
+    std::string dir;
+    uint32_t segment = UINT32_MAX;
+    int data_fd = -1;
+    int list_fd = -1;
+    std::string key;
+    std::unique_ptr<Crypto> crypto;
+    
+    ~OpenSegment() {
+        close_all();
+    }
+    
+    void close_all() {
+        if (data_fd != -1) {
+            close(data_fd);
+        }
+        if (list_fd != -1) {
+            close(list_fd);
+        }
+        data_fd = -1;
+        list_fd = -1;
+        dir.clear();
+    }
+    
+    bool open_for(const std::string& archive, uint32_t slot) {
+        close_all();
+        std::string path = Archive::segment_path(archive, slot);
+        data_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        list_fd = open((path + ".list").c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (data_fd == -1 || list_fd == -1) {
+            close_all();
+            return false;
+        }
+        
+        // A worker that died in this slot may have left half a record
+        std::vector<uint8_t> list;
+        if (read_whole(path + ".list", list)) {
+            size_t end = parse_list(list, [](const ListRecord&, const std::string&) {});
+            if (end < list.size() && ftruncate(list_fd, end) == -1) {
+                close_all();
+                return false;
+            }
+        }
+        dir = archive;
+        segment = slot;
+        return true;
+    }
+};
+
+OpenSegment& current_segment() {
+    static thread_local OpenSegment segment;
+    return segment;
+}
+    
+} // namespace
+
+std::string Archive::segment_path(const std::string& dir, uint32_t segment) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/seg-%03u", segment);
+    return dir + name;
+}
+
+std::string Archive::index_path(const std::string& dir) {
+    return dir + "/index";
+}
+
+bool Archive::create(const std::string& dir) {
+    if (mkdir(dir.c_str(), 0755) == 0) {
+        return true;
+    }
+    if (errno == EEXIST) {
+        DIR* listing = opendir(dir.c_str());
+        if (listing != nullptr) {
+            size_t entries = 0;
+            while (struct dirent* entry = readdir(listing)) {
+                if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0) {
+                    entries++;
+                }
+            }
+            closedir(listing);
+            if (entries == 0) {
+                return true;
+            }
+        }
+        std::cerr << "Archive already exists: " << dir << std::endl;
+        return false;
+    }
+    std::cerr << "Failed to create archive " << dir << ": " << strerror(errno) << std::endl;
+    return false;
+}
+
+bool Archive::append(const TaskSpec& task, size_t segment, size_t chunk_bytes) {
+    OpenSegment& open_segment = current_segment();
+    uint32_t slot = static_cast<uint32_t>(segment);
+    if ((open_segment.dir != task.output_file || open_segment.segment != slot) &&
+        !open_segment.open_for(task.output_file, slot)) {
+        std::cerr << "Failed to open archive segment: "
+                  << segment_path(task.output_file, slot) << std::endl;
+        return false;
+    }
+    if (!open_segment.crypto || open_segment.key != task.key) {
+        open_segment.crypto.reset(new Crypto(task.key));
+        open_segment.key = task.key;
+    }
+    
+    uint64_t span = TraceBuffer::now();
+    int input = open(task.input_file.c_str(), O_RDONLY | O_CLOEXEC);
+    TraceBuffer::record(TraceStage::OPEN, span);
+    if (input == -1) {
+        std::cerr << "Failed to open input file: " << task.input_file << std::endl;
+        return false;
+    }
+    
+    // Members start at the segment's end; bytes a crashed worker left
+    // there are never referenced by a list record
+    off_t start = lseek(open_segment.data_fd, 0, SEEK_END);
+    Crypto& crypto = *open_segment.crypto;
+    crypto.seek(0);
+    BufferPool::Buffer buffer = BufferPool::local().acquire(chunk_bytes);
+    uint64_t length = 0;
+    bool ok = start != -1;
+    
+    while (ok) {
+        Heartbeat::beat();
+        span = TraceBuffer::now();
+        ssize_t got = read(input, buffer.data(), buffer.size());
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            ok = got == 0;
+            break;
+        }
+        TraceBuffer::record(TraceStage::READ, span, got);
+        
+        // Charged once the length is known; the debt delays the next chunk
+        Throttle::read(got);
+        
+        span = TraceBuffer::now();
+        crypto.process(buffer.data(), got);
+        TraceBuffer::record(TraceStage::CRYPTO, span, got);
+        
+        Throttle::write(got);
+        span = TraceBuffer::now();
+        ok = write_all(open_segment.data_fd, buffer.data(), got);
+        TraceBuffer::record(TraceStage::WRITE, span, got);
+        length += got;
+    }
+    close(input);
+    
+    // Record the member only once all of its bytes are in the segment
+    if (ok) {
+        ListRecord record = {static_cast<uint64_t>(start), length,
+                             static_cast<uint32_t>(task.input_file.size()), 0};
+        std::string entry(reinterpret_cast<const char*>(&record), sizeof(record));
+        entry += task.input_file;
+        ok = write_all(open_segment.list_fd, entry.data(), entry.size());
+    }
+    if (!ok) {
+        std::cerr << "Failed to append to archive: " << task.input_file << std::endl;
+    }
+    return ok;
+}
+
+bool Archive::write_index(const std::string& dir, size_t* members) {
+    struct Pending {
+        std::string name;
+        uint32_t segment;
+        uint64_t offset;
+        uint64_t length;
+    };
+    std::vector<Pending> all;
+    std::vector<std::string> lists;
+    
+    DIR* listing = opendir(dir.c_str());
+    if (listing == nullptr) {
+        std::cerr << "Failed to open archive: " << dir << std::endl;
+        return false;
+    }
+    while (struct dirent* entry = readdir(listing)) {
+        unsigned int segment;
+        int used = 0;
+        if (std::sscanf(entry->d_name, "seg-%u.list%n", &segment, &used) != 1 ||
+            entry->d_name[used] != '\0') {
+            continue;
+        }
+        std::string path = dir + "/" + entry->d_name;
+        std::vector<uint8_t> data;
+        if (!read_whole(path, data)) {
+            closedir(listing);
+            std::cerr << "Failed to read archive list: " << path << std::endl;
+            return false;
+        }
+        parse_list(data, [&](const ListRecord& record, const std::string& name) {
+            all.push_back({name, segment, record.offset, record.length});
+        });
+        lists.push_back(path);
+    }
+    closedir(listing);
+    
+    // Sorted by name for binary search; requeued tasks may appear twice
+    std::stable_sort(all.begin(), all.end(),
+                     [](const Pending& a, const Pending& b) { return a.name < b.name; });
+    all.erase(std::unique(all.begin(), all.end(),
+                          [](const Pending& a, const Pending& b) { return a.name == b.name; }),
+              all.end());
+    
+    IndexHeader header;
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.count = all.size();
+    header.names_offset = sizeof(IndexHeader) + all.size() * sizeof(IndexEntry);
+    
+    std::vector<IndexEntry> entries;
+    entries.reserve(all.size());
+    std::string names;
+    for (const Pending& member : all) {
+        entries.push_back({names.size(), static_cast<uint32_t>(member.name.size()),
+                           member.segment, member.offset, member.length});
+        names += member.name;
+    }
+    
+    // Written aside and renamed, so readers never map a partial index
+    std::string path = index_path(dir);
+    std::string temp = path + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd != -1 &&
+              write_all(fd, &header, sizeof(header)) &&
+              write_all(fd, entries.data(), entries.size() * sizeof(IndexEntry)) &&
+              write_all(fd, names.data(), names.size()) &&
+              fsync(fd) == 0;
+    if (fd != -1) {
+        close(fd);
+    }
+    if (!ok || rename(temp.c_str(), path.c_str()) == -1) {
+        unlink(temp.c_str());
+        std::cerr << "Failed to write archive index: " << path << std::endl;
+        return false;
+    }
+    
+    for (const std::string& list : lists) {
+        unlink(list.c_str());
+    }
+    if (members != nullptr) {
+        *members = all.size();
+    }
+    return true;
+}
+
+// ============================================================================
+// ArchiveIndex Implementation
+// ============================================================================
+
+ArchiveIndex::ArchiveIndex(const std::string& dir)
+    : dir_(dir), map_(nullptr), map_size_(0), entries_(nullptr), names_(nullptr), count_(0) {
+    std::string path = Archive::index_path(dir);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        throw std::runtime_error("Failed to open archive index " + path + ": " +
+                                 std::string(strerror(errno)));
+    }
+    map_size_ = st.st_size;
+    if (map_size_ < sizeof(Archive::IndexHeader)) {
+        close(fd);
+        throw std::runtime_error("Archive index is truncated: " + path);
+    }
+    
+    map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        throw std::runtime_error("Failed to map archive index: " + std::string(strerror(errno)));
+    }
+    
+    const auto* header = static_cast<const Archive::IndexHeader*>(map_);
+    const char* base = static_cast<const char*>(map_);
+    bool valid = std::memcmp(header->magic, Archive::INDEX_MAGIC, 4) == 0 &&
+                 header->version == Archive::INDEX_VERSION &&
+                 header->count <= (map_size_ - sizeof(*header)) / sizeof(Archive::IndexEntry) &&
+                 header->names_offset == sizeof(*header) +
+                                         header->count * sizeof(Archive::IndexEntry);
+    if (!valid) {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        throw std::runtime_error("Not an archive index: " + path);
+    }
+    count_ = header->count;
+    entries_ = reinterpret_cast<const Archive::IndexEntry*>(base + sizeof(*header));
+    names_ = base + header->names_offset;
+}
+
+ArchiveIndex::~ArchiveIndex() {
+    if (map_ != nullptr) {
+        munmap(map_, map_size_);
+    }
+}
+
+ArchiveIndex::Member ArchiveIndex::at(size_t i) const {
+    const Archive::IndexEntry& entry = entries_[i];
+    size_t names_size = map_size_ - (names_ - static_cast<const char*>(map_));
+    if (entry.name_offset > names_size || entry.name_length > names_size - entry.name_offset) {
+        throw std::runtime_error("Corrupt archive index entry");
+    }
+    return {std::string(names_ + entry.name_offset, entry.name_length),
+            entry.segment, entry.offset, entry.length};
+}
+
+bool ArchiveIndex::find(const std::string& name, Member& member) const {
+    size_t low = 0;
+    size_t high = count_;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        Member candidate = at(mid);
+        int order = std::string_view(candidate.name).compare(name);
+        if (order == 0) {
+            member = std::move(candidate);
+            return true;
+        }
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return false;
+}
+
+bool ArchiveIndex::extract(const Member& member, const std::string& key,
+                           const std::string& output) const {
+    std::string path = Archive::segment_path(dir_, member.segment);
+    int input = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input == -1) {
+        std::cerr << "Failed to open archive segment: " << path << std::endl;
+        return false;
+    }
+    int out = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out == -1) {
+        close(input);
+        std::cerr << "Failed to open output file: " << output << std::endl;
+        return false;
+    }
+    
+    Crypto crypto(key);
+    BufferPool::Buffer buffer = BufferPool::local().acquire(
+        std::min<uint64_t>(std::max<uint64_t>(member.length, 1), 1024 * 1024));
+    uint64_t done = 0;
+    bool ok = true;
+    while (ok && done < member.length) {
+        size_t n = std::min<uint64_t>(buffer.size(), member.length - done);
+        ok = pread(input, buffer.data(), n, member.offset + done) == static_cast<ssize_t>(n);
+        if (ok) {
+            crypto.process(buffer.data(), n);
+            ok = write_all(out, buffer.data(), n);
+        }
+        done += n;
+    }
+    close(input);
+    close(out);
+    
+    if (!ok) {
+        std::cerr << "Failed to extract " << member.name << " (truncated segment?)" << std::endl;
+    }
+    return ok;
+}
+    
+} // namespace cryptstream
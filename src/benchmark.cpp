@@ -35,11 +35,11 @@ void generate_test_file(const std::string& filename, size_t size_bytes) {
 
 // Benchmark single-threaded processing
 double benchmark_single_threaded(const std::string& input, const std::string& output, const std::string& key) {
-    Task task;
-    task.type = Task::ENCRYPT;
-    task.set_input(input);
-    task.set_output(output);
-    task.set_key(key);
+    TaskSpec task;
+    task.type = TaskSpec::ENCRYPT;
+    task.input_file = input;
+    task.output_file = output;
+    task.key = key;
     
     auto start = high_resolution_clock::now();
     FileProcessor::process_file(task);
@@ -52,11 +52,12 @@ double benchmark_single_threaded(const std::string& input, const std::string& ou
 double benchmark_multiprocess(const std::string& input, const std::string& output, 
                              const std::string& key, size_t num_processes) {
     size_t shm_size = sizeof(TaskQueue::QueueData);
-    SharedMemory shm("/cryptstream_bench", shm_size, true);
+    std::string run = unique_ipc_name("/cryptstream_bench");
+    SharedMemory shm(run + "_queue", shm_size, true);
     TaskQueue queue(shm, true);
     
-    Semaphore task_sem("/cryptstream_bench_task", 0, true);
-    Semaphore done_sem("/cryptstream_bench_done", 0, true);
+    Semaphore task_sem(run + "_task_sem", 0, true);
+    Semaphore done_sem(run + "_done_sem", 0, true);
     
     ProcessPool pool(num_processes, queue, task_sem, done_sem);
     
@@ -64,20 +65,19 @@ double benchmark_multiprocess(const std::string& input, const std::string& outpu
     
     pool.start();
     
-    Task task;
-    task.type = Task::ENCRYPT;
-    task.set_input(input);
-    task.set_output(output);
-    task.set_key(key);
+    TaskSpec task;
+    task.type = TaskSpec::ENCRYPT;
+    task.input_file = input;
+    task.output_file = output;
+    task.key = key;
     
     queue.enqueue(task);
     task_sem.post();
+    pool.scale();
     done_sem.wait();
     
     queue.signal_shutdown();
-    for (size_t i = 0; i < num_processes; ++i) {
-        task_sem.post();
-    }
+    pool.signal_workers();
     
     pool.wait_all();
     
@@ -91,6 +91,8 @@ double benchmark_multiprocess(const std::string& input, const std::string& outpu
 }
 
 int main() {
+    remove_stale_ipc("/cryptstream_bench");
+    
     std::cout << "CryptStream Benchmark Suite\n";
     std::cout << "============================\n\n";
     
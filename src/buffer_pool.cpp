@@ -0,0 +1,89 @@
+#include "buffer_pool.hpp"
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+
+namespace cryptstream {
+
+BufferPool::Buffer::~Buffer() {
+    release();
+}
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+    : pool_(other.pool_), data_(other.data_), size_(other.size_) {
+    other.pool_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        data_ = other.data_;
+        size_ = other.size_;
+        other.pool_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+void BufferPool::Buffer::release() {
+    if (data_ == nullptr) {
+        return;
+    }
+    pool_->give_back(data_, size_);
+    data_ = nullptr;
+}
+
+BufferPool::~BufferPool() {
+    for (const Slab& slab : idle_) {
+        std::free(slab.data);
+    }
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t size) {
+    size = round_up(std::max<size_t>(size, 1));
+    
+    // Best fit among the idle buffers
+    auto best = idle_.end();
+    for (auto it = idle_.begin(); it != idle_.end(); ++it) {
+        if (it->size >= size && (best == idle_.end() || it->size < best->size)) {
+            best = it;
+        }
+    }
+    if (best != idle_.end()) {
+        Slab slab = *best;
+        idle_.erase(best);
+        ++reuses_;
+        return Buffer(this, slab.data, slab.size);
+    }
+    
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, ALIGNMENT, size) != 0) {
+        throw std::bad_alloc();
+    }
+    ++allocations_;
+    return Buffer(this, static_cast<uint8_t*>(ptr), size);
+}
+
+void BufferPool::give_back(uint8_t* data, size_t size) {
+    idle_.push_back({data, size});
+    if (idle_.size() <= MAX_CACHED) {
+        return;
+    }
+    
+    // Over the cap: free the smallest, larger buffers serve more requests
+    auto smallest = std::min_element(idle_.begin(), idle_.end(),
+                                     [](const Slab& a, const Slab& b) { return a.size < b.size; });
+    std::free(smallest->data);
+    idle_.erase(smallest);
+}
+
+BufferPool& BufferPool::local() {
+    static thread_local BufferPool pool;
+    return pool;
+}
+    
+} // namespace cryptstream
@@ -0,0 +1,1049 @@
+#include "cluster.hpp"
+#include "scheduler.hpp"
+#include "file_processor.hpp"
+#include "crypto.hpp"
+#include "sha256.hpp"
+#include "heartbeat.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace cryptstream {
+
+namespace {
+
+constexpr uint32_t PROTOCOL_VERSION = 2;
+constexpr size_t FRAME_HEADER_BYTES = 5;                    // u32 length, u8 type
+constexpr uint32_t MAX_FRAME_BYTES = 64 * 1024 * 1024;
+constexpr unsigned int SEND_TIMEOUT_MS = 30000;
+constexpr size_t NONCE_BYTES = 32;
+
+// Frames: little-endian u32 payload length, u8 message type, payload.
+// Handshake: HELLO, CHALLENGE, AUTH, WELCOME; each side proves it holds
+// the key with an HMAC over both nonces, so the key never crosses the
+// network and a recorded proof is useless on another connection
+enum MessageType : uint8_t {
+    MSG_HELLO = 1,      // Worker: version, worker nonce, name
+    MSG_WELCOME,        // Coordinator: stream flag, lease timeout, coordinator proof
+    MSG_REQUEST,        // Worker: ready for a unit
+    MSG_UNIT,           // Coordinator: unit id, task count, tasks by path
+    MSG_CHUNK,          // Coordinator: unit id, task type, stream offset, data
+    MSG_DONE,           // Worker: unit id, task count, one result byte per task
+    MSG_CHUNK_DONE,     // Worker: unit id, result byte, processed data
+    MSG_BYE,            // Coordinator: batch finished
+    MSG_ERROR,          // Either side: message, then close
+    MSG_CHALLENGE,      // Coordinator: coordinator nonce
+    MSG_AUTH,           // Worker: worker proof
+    MSG_PROGRESS        // Worker: its unit is still advancing
+};
+
+// The connection broke (as opposed to a refusal or a protocol error)
+struct ConnectionLost : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string random_nonce() {
+    std::string nonce(NONCE_BYTES, '\0');
+    size_t filled = 0;
+    while (filled < nonce.size()) {
+        ssize_t got = getrandom(&nonce[filled], nonce.size() - filled, 0);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            throw std::runtime_error("getrandom failed: " + std::string(strerror(errno)));
+        }
+        filled += got;
+    }
+    return nonce;
+}
+
+// Proof that the sender holds the key, bound to this connection's nonces;
+// the role label keeps one side's proof from being replayed as the other's
+Sha256::Digest key_proof(const std::string& key, const char* role,
+                         const std::string& coordinator_nonce, const std::string& worker_nonce) {
+    return Sha256::hmac(key, std::string("cryptstream-auth:") + role + ":" +
+                             coordinator_nonce + worker_nonce);
+}
+
+void send_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            throw ConnectionLost("Send failed: " + std::string(strerror(errno)));
+        }
+        data += sent;
+        size -= sent;
+    }
+}
+
+bool recv_all(int fd, uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t got = recv(fd, data, size, 0);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            throw std::runtime_error("Receive failed: " + std::string(strerror(errno)));
+        }
+        if (got == 0) {
+            return false;
+        }
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+/**
+ * Builds one frame; the length is filled in when sent
+ */
+class WireWriter {
+public:
+    explicit WireWriter(uint8_t type) : bytes_(FRAME_HEADER_BYTES, 0) {
+        bytes_[4] = type;
+    }
+    
+    void u8(uint8_t value) {
+        bytes_.push_back(value);
+    }
+    
+    void u32(uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            bytes_.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+    
+    void u64(uint64_t value) {
+        u32(static_cast<uint32_t>(value));
+        u32(static_cast<uint32_t>(value >> 32));
+    }
+    
+    void str(const std::string& value) {
+        u32(static_cast<uint32_t>(value.size()));
+        bytes_.insert(bytes_.end(), value.begin(), value.end());
+    }
+    
+    void raw(const uint8_t* data, size_t size) {
+        bytes_.insert(bytes_.end(), data, data + size);
+    }
+    
+    void raw(const std::string& data) {
+        bytes_.insert(bytes_.end(), data.begin(), data.end());
+    }
+    
+    void digest(const Sha256::Digest& value) {
+        bytes_.insert(bytes_.end(), value.begin(), value.end());
+    }
+    
+    void send(int fd) {
+        uint32_t length = static_cast<uint32_t>(bytes_.size() - FRAME_HEADER_BYTES);
+        for (int i = 0; i < 4; ++i) {
+            bytes_[i] = static_cast<uint8_t>(length >> (8 * i));
+        }
+        send_all(fd, bytes_.data(), bytes_.size());
+    }
+
+private:
+    std::vector<uint8_t> bytes_;
+};
+
+/**
+ * Bounds-checked reader over a frame payload
+ */
+class WireReader {
+public:
+    explicit WireReader(const std::vector<uint8_t>& payload)
+        : data_(payload.data()), size_(payload.size()), pos_(0) {}
+    
+    uint8_t u8() {
+        need(1);
+        return data_[pos_++];
+    }
+    
+    uint32_t u32() {
+        need(4);
+        uint32_t value = get32(data_ + pos_);
+        pos_ += 4;
+        return value;
+    }
+    
+    uint64_t u64() {
+        uint64_t low = u32();
+        return low | (static_cast<uint64_t>(u32()) << 32);
+    }
+    
+    std::string str() {
+        uint32_t length = u32();
+        need(length);
+        std::string value(reinterpret_cast<const char*>(data_ + pos_), length);
+        pos_ += length;
+        return value;
+    }
+    
+    std::string raw(size_t length) {
+        need(length);
+        std::string value(reinterpret_cast<const char*>(data_ + pos_), length);
+        pos_ += length;
+        return value;
+    }
+    
+    Sha256::Digest digest() {
+        need(Sha256::DIGEST_BYTES);
+        Sha256::Digest value;
+        std::memcpy(value.data(), data_ + pos_, value.size());
+        pos_ += value.size();
+        return value;
+    }
+    
+    // Everything after the fields read so far
+    const uint8_t* rest(size_t& length) {
+        length = size_ - pos_;
+        return data_ + pos_;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_;
+    
+    void need(size_t bytes) {
+        if (size_ - pos_ < bytes) {
+            throw std::runtime_error("Truncated message");
+        }
+    }
+};
+
+// Blocking read of one frame; false when the peer closed the connection
+bool read_frame(int fd, uint8_t& type, std::vector<uint8_t>& payload) {
+    uint8_t header[FRAME_HEADER_BYTES];
+    if (!recv_all(fd, header, sizeof(header))) {
+        return false;
+    }
+    uint32_t length = get32(header);
+    if (length > MAX_FRAME_BYTES) {
+        throw std::runtime_error("Oversized message");
+    }
+    type = header[4];
+    payload.resize(length);
+    if (!recv_all(fd, payload.data(), length)) {
+        throw ConnectionLost("Connection closed mid-message");
+    }
+    return true;
+}
+
+void send_error(int fd, const std::string& message) {
+    try {
+        WireWriter frame(MSG_ERROR);
+        frame.str(message);
+        frame.send(fd);
+    } catch (const std::exception&) {
+        // The connection is being dropped anyway
+    }
+}
+
+// "host:port", ":port" or "port"; an empty host means any (listen) or
+// loopback (connect)
+void split_address(const std::string& address, std::string& host, std::string& port) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        host.clear();
+        port = address;
+    } else {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+    if (port.empty()) {
+        throw std::runtime_error("Missing port in address: " + address);
+    }
+}
+
+struct AddressList {
+    addrinfo* head = nullptr;
+    ~AddressList() {
+        if (head != nullptr) {
+            freeaddrinfo(head);
+        }
+    }
+};
+
+void resolve(const std::string& address, bool passive, AddressList& list) {
+    std::string host, port;
+    split_address(address, host, port);
+    
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints,
+                         &list.head);
+    if (rc != 0) {
+        throw std::runtime_error("Failed to resolve " + address + ": " + gai_strerror(rc));
+    }
+}
+
+void set_no_delay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+ * A remote worker's outgoing frames, plus PROGRESS while a unit advances
+ * A background thread sends PROGRESS every interval in which the worker's
+ * heartbeat moved, so the coordinator's lease runs from the last progress
+ * and a truly stuck worker still goes quiet. All frames share one mutex;
+ * end_unit() sends the result under it, so no PROGRESS trails a result
+ */
+class ProgressReporter {
+public:
+    ProgressReporter(int fd, unsigned int interval_ms)
+        : fd_(fd), interval_ms_(interval_ms), busy_(false), stop_(false), stamp_(0) {
+        Heartbeat::attach(&stamp_);
+        if (interval_ms_ > 0) {
+            thread_ = std::thread(&ProgressReporter::loop, this);
+        }
+    }
+    
+    ~ProgressReporter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        Heartbeat::attach(nullptr);
+    }
+    
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+    
+    void send(WireWriter& frame) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        frame.send(fd_);
+    }
+    
+    void begin_unit() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_ = true;
+        Heartbeat::beat();
+    }
+    
+    void end_unit(WireWriter& result) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_ = false;
+        result.send(fd_);
+    }
+
+private:
+    int fd_;
+    unsigned int interval_ms_;
+    bool busy_;
+    bool stop_;
+    uint64_t stamp_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread thread_;
+    
+    void loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t reported = 0;
+        while (!stop_) {
+            wake_.wait_for(lock, std::chrono::milliseconds(interval_ms_));
+            uint64_t stamp = __atomic_load_n(&stamp_, __ATOMIC_RELAXED);
+            if (stop_ || !busy_ || stamp == reported) {
+                continue;
+            }
+            try {
+                WireWriter(MSG_PROGRESS).send(fd_);
+                reported = stamp;
+            } catch (const std::exception&) {
+                // The worker's own next send or read reports the broken link
+                return;
+            }
+        }
+    }
+};
+    
+} // namespace
+
+// ============================================================================
+// Coordinator Implementation
+// ============================================================================
+
+Coordinator::Coordinator(const ClusterOptions& options)
+    : options_(options), listen_fd_(-1), remaining_(0) {
+    if (options_.workers_hint == 0) {
+        options_.workers_hint = 1;
+    }
+}
+
+Coordinator::~Coordinator() {
+    for (const Client& client : clients_) {
+        close(client.fd);
+    }
+    if (listen_fd_ != -1) {
+        close(listen_fd_);
+    }
+}
+
+uint16_t Coordinator::listen() {
+    AddressList list;
+    resolve(options_.address, true, list);
+    
+    int error = 0;
+    for (addrinfo* ai = list.head; ai != nullptr; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        ai->ai_protocol);
+        if (fd == -1) {
+            error = errno;
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0) {
+            listen_fd_ = fd;
+            break;
+        }
+        error = errno;
+        close(fd);
+    }
+    if (listen_fd_ == -1) {
+        throw std::runtime_error("Failed to listen on " + options_.address + ": " +
+                                 std::string(strerror(error)));
+    }
+    
+    sockaddr_storage bound;
+    socklen_t length = sizeof(bound);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&bound), &length);
+    if (bound.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port);
+    }
+    return ntohs(reinterpret_cast<sockaddr_in*>(&bound)->sin_port);
+}
+
+std::vector<Coordinator::Unit> Coordinator::plan(
+        TaskSpec::Type type, const std::vector<std::pair<std::string, std::string>>& files) {
+    std::vector<Unit> units;
+    
+    // Path mode: the same split/pack/LPT plan as a local pool
+    if (!options_.stream) {
+        Scheduler::Options scheduling;
+        scheduling.num_workers = options_.workers_hint;
+        Scheduler scheduler(scheduling);
+        for (const auto& file : files) {
+            scheduler.add(type, file.first, file.second);
+        }
+        for (Scheduler::WorkUnit& work : scheduler.plan("", options_.flags)) {
+            Unit unit;
+            unit.tasks = std::move(work.tasks);
+            unit.bytes = work.bytes;
+            units.push_back(std::move(unit));
+        }
+        return units;
+    }
+    
+    // Stream mode: fixed-size chunks written in place into pre-sized outputs.
+    // An output that is its own input already has the size, and truncating
+    // it would destroy chunks not yet read; each chunk is read before its
+    // result is written, so writing it in place is safe
+    for (const auto& file : files) {
+        uint64_t size = FileProcessor::get_file_size(file.first);
+        if (!FileProcessor::same_file(file.first, file.second)) {
+            int fd = open(file.second.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1 || ftruncate(fd, size) == -1) {
+                if (fd != -1) {
+                    close(fd);
+                }
+                throw std::runtime_error("Failed to pre-size output " + file.second +
+                                         ": " + std::string(strerror(errno)));
+            }
+            close(fd);
+        }
+        
+        for (uint64_t offset = 0; offset < size; offset += STREAM_CHUNK_BYTES) {
+            TaskSpec task;
+            task.type = type;
+            task.input_file = file.first;
+            task.output_file = file.second;
+            task.offset = offset;
+            task.length = std::min(STREAM_CHUNK_BYTES, size - offset);
+            
+            Unit unit;
+            unit.bytes = task.length;
+            unit.tasks.push_back(task);
+            units.push_back(std::move(unit));
+        }
+    }
+    return units;
+}
+
+ClusterResult Coordinator::run(TaskSpec::Type type,
+                               const std::vector<std::pair<std::string, std::string>>& files) {
+    if (listen_fd_ == -1) {
+        listen();
+    }
+    uint64_t start = now_ns();
+    
+    units_ = plan(type, files);
+    result_ = ClusterResult();
+    result_.units = units_.size();
+    pending_.clear();
+    for (size_t i = 0; i < units_.size(); ++i) {
+        pending_.push_back(i);
+        result_.tasks += units_[i].tasks.size();
+        result_.bytes += units_[i].bytes;
+    }
+    remaining_ = units_.size();
+    
+    while (remaining_ > 0) {
+        std::vector<pollfd> fds(1 + clients_.size());
+        fds[0] = {listen_fd_, POLLIN, 0};
+        for (size_t i = 0; i < clients_.size(); ++i) {
+            fds[i + 1] = {clients_[i].fd, POLLIN, 0};
+        }
+        
+        int ready = poll(fds.data(), fds.size(), 100);
+        if (ready == -1 && errno != EINTR) {
+            throw std::runtime_error("Poll failed: " + std::string(strerror(errno)));
+        }
+        
+        // Highest index first, so dropping a client leaves lower indices valid
+        for (size_t i = fds.size() - 1; ready > 0 && i > 0; --i) {
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !receive(clients_[i - 1])) {
+                drop(i - 1, "disconnected");
+            }
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            accept_clients();
+        }
+        
+        // A worker silent past the lease timeout loses its unit; workers
+        // holding one send PROGRESS while it advances, so only a stalled or
+        // unreachable worker goes quiet
+        if (options_.lease_timeout_ms > 0) {
+            uint64_t limit = static_cast<uint64_t>(options_.lease_timeout_ms) * 1000000;
+            uint64_t now = now_ns();
+            for (size_t i = clients_.size(); i-- > 0;) {
+                if (clients_[i].unit >= 0 && now - clients_[i].heard_ns > limit) {
+                    drop(i, "lease timed out");
+                }
+            }
+        }
+        
+        // Units requeued from lost workers go to workers already waiting
+        for (size_t i = clients_.size(); i-- > 0;) {
+            if (clients_[i].waiting && !pending_.empty() && !dispatch(clients_[i])) {
+                drop(i, "send failed");
+            }
+        }
+    }
+    
+    // Batch finished: release every worker
+    for (const Client& client : clients_) {
+        try {
+            WireWriter(MSG_BYE).send(client.fd);
+        } catch (const std::exception&) {
+            // Already gone
+        }
+        close(client.fd);
+    }
+    clients_.clear();
+    
+    result_.elapsed_ms = (now_ns() - start) / 1e6;
+    return result_;
+}
+
+void Coordinator::accept_clients() {
+    while (true) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        set_no_delay(fd);
+        
+        // Sends block, but not forever on a stalled worker
+        timeval timeout = {SEND_TIMEOUT_MS / 1000, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        
+        Client client;
+        client.fd = fd;
+        clients_.push_back(std::move(client));
+    }
+}
+
+bool Coordinator::receive(Client& client) {
+    uint8_t buffer[256 * 1024];
+    ssize_t got = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return true;
+    }
+    if (got <= 0) {
+        return false;
+    }
+    client.inbox.insert(client.inbox.end(), buffer, buffer + got);
+    
+    // Handle every complete frame received so far
+    size_t used = 0;
+    while (client.inbox.size() - used >= FRAME_HEADER_BYTES) {
+        uint32_t length = get32(client.inbox.data() + used);
+        if (length > MAX_FRAME_BYTES) {
+            return false;
+        }
+        if (client.inbox.size() - used < FRAME_HEADER_BYTES + length) {
+            break;
+        }
+        uint8_t type = client.inbox[used + 4];
+        auto begin = client.inbox.begin() + used + FRAME_HEADER_BYTES;
+        std::vector<uint8_t> payload(begin, begin + length);
+        used += FRAME_HEADER_BYTES + length;
+        
+        try {
+            if (!handle_frame(client, type, payload)) {
+                return false;
+            }
+            client.heard_ns = now_ns();
+        } catch (const std::exception& e) {
+            send_error(client.fd, e.what());
+            return false;
+        }
+    }
+    client.inbox.erase(client.inbox.begin(), client.inbox.begin() + used);
+    return true;
+}
+
+bool Coordinator::handle_frame(Client& client, uint8_t type,
+                               const std::vector<uint8_t>& payload) {
+    WireReader reader(payload);
+    
+    if (type == MSG_HELLO) {
+        uint32_t version = reader.u32();
+        if (version != PROTOCOL_VERSION) {
+            send_error(client.fd, "Protocol version mismatch");
+            return false;
+        }
+        if (!client.challenge.empty()) {
+            return false;
+        }
+        client.worker_nonce = reader.raw(NONCE_BYTES);
+        client.name = reader.str();
+        
+        // A fresh nonce per connection: proofs cannot be replayed
+        client.challenge = random_nonce();
+        WireWriter challenge(MSG_CHALLENGE);
+        challenge.raw(client.challenge);
+        challenge.send(client.fd);
+        return true;
+    }
+    
+    if (type == MSG_AUTH) {
+        if (client.challenge.empty() || client.welcomed) {
+            return false;
+        }
+        Sha256::Digest expected = key_proof(options_.key, "worker", client.challenge,
+                                            client.worker_nonce);
+        if (!Sha256::equal(reader.digest(), expected)) {
+            if (options_.log_level <= LogLevel::WARN) {
+                std::cerr << "[coordinator] rejected worker " << client.name
+                          << ": key mismatch" << std::endl;
+            }
+            send_error(client.fd, "Key does not match the coordinator's");
+            return false;
+        }
+        client.welcomed = true;
+        result_.workers++;
+        if (options_.log_level <= LogLevel::DEBUG) {
+            std::cout << "[coordinator] worker joined: " << client.name << std::endl;
+        }
+        
+        // Sent only to a proven worker, so it is no oracle for strangers
+        WireWriter welcome(MSG_WELCOME);
+        welcome.u8(options_.stream ? 1 : 0);
+        welcome.u32(options_.lease_timeout_ms);
+        welcome.digest(key_proof(options_.key, "coordinator", client.challenge,
+                                 client.worker_nonce));
+        welcome.send(client.fd);
+        return true;
+    }
+    
+    if (!client.welcomed) {
+        return false;
+    }
+    
+    if (type == MSG_REQUEST) {
+        return client.unit < 0 && dispatch(client);
+    }
+    
+    // Liveness only: receive() already restamped the client
+    if (type == MSG_PROGRESS) {
+        return true;
+    }
+    
+    if (type != MSG_DONE && type != MSG_CHUNK_DONE) {
+        throw std::runtime_error("Unexpected message");
+    }
+    // Checked before comparing: a worker holding no unit (-1) must not get
+    // a result for id UINT64_MAX accepted
+    if (client.unit < 0 || reader.u64() != static_cast<uint64_t>(client.unit)) {
+        throw std::runtime_error("Result for a unit not assigned to this worker");
+    }
+    const Unit& unit = units_[client.unit];
+    std::vector<bool> results;
+    
+    if (type == MSG_DONE) {
+        uint32_t count = reader.u32();
+        if (count != unit.tasks.size()) {
+            throw std::runtime_error("Result count does not match the unit");
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            results.push_back(reader.u8() != 0);
+        }
+    } else {
+        // Stream mode: write the processed chunk back in place
+        const TaskSpec& task = unit.tasks.front();
+        bool success = reader.u8() != 0;
+        size_t length;
+        const uint8_t* data = reader.rest(length);
+        if (success && length == task.length) {
+            int fd = open(task.output_file.c_str(), O_WRONLY);
+            success = fd != -1 &&
+                      pwrite(fd, data, length, task.offset) == static_cast<ssize_t>(length);
+            if (fd != -1) {
+                close(fd);
+            }
+            if (!success) {
+                std::cerr << "Failed to write output file: " << task.output_file << std::endl;
+            }
+        } else {
+            success = false;
+        }
+        results.push_back(success);
+    }
+    
+    finish_unit(client, results);
+    return true;
+}
+
+bool Coordinator::dispatch(Client& client) {
+    while (!pending_.empty()) {
+        size_t index = pending_.front();
+        pending_.pop_front();
+        const Unit& unit = units_[index];
+        
+        try {
+            if (!options_.stream) {
+                WireWriter frame(MSG_UNIT);
+                frame.u64(index);
+                frame.u32(static_cast<uint32_t>(unit.tasks.size()));
+                for (const TaskSpec& task : unit.tasks) {
+                    frame.u8(task.type);
+                    frame.u32(task.flags);
+                    frame.u64(task.offset);
+                    frame.u64(task.length);
+                    frame.str(task.input_file);
+                    frame.str(task.output_file);
+                }
+                frame.send(client.fd);
+            } else {
+                // Ship the chunk's bytes; an unreadable input fails the task here
+                const TaskSpec& task = unit.tasks.front();
+                std::vector<uint8_t> data(task.length);
+                int fd = open(task.input_file.c_str(), O_RDONLY);
+                bool read_ok = fd != -1 &&
+                    pread(fd, data.data(), data.size(), task.offset) ==
+                        static_cast<ssize_t>(data.size());
+                if (fd != -1) {
+                    close(fd);
+                }
+                if (!read_ok) {
+                    std::cerr << "Failed to read input file: " << task.input_file << std::endl;
+                    client.unit = static_cast<long>(index);
+                    finish_unit(client, {false});
+                    continue;
+                }
+                
+                WireWriter frame(MSG_CHUNK);
+                frame.u64(index);
+                frame.u8(task.type);
+                frame.u64(task.offset);
+                frame.raw(data.data(), data.size());
+                frame.send(client.fd);
+            }
+        } catch (const std::exception&) {
+            pending_.push_front(index);
+            return false;
+        }
+        
+        client.unit = static_cast<long>(index);
+        client.heard_ns = now_ns();
+        client.waiting = false;
+        return true;
+    }
+    
+    // Nothing queued: answer once a lost worker's unit comes back, or with
+    // the final BYE
+    client.waiting = true;
+    return true;
+}
+
+void Coordinator::finish_unit(Client& client, const std::vector<bool>& results) {
+    Unit& unit = units_[client.unit];
+    unit.done = true;
+    remaining_--;
+    for (bool success : results) {
+        if (success) {
+            result_.succeeded++;
+        } else {
+            result_.failed++;
+        }
+    }
+    client.unit = -1;
+}
+
+void Coordinator::drop(size_t index, const char* reason) {
+    Client& client = clients_[index];
+    if (client.unit >= 0) {
+        Unit& unit = units_[client.unit];
+        result_.lost_workers++;
+        const char* outcome = "unit requeued";
+        
+        // A unit that keeps losing its workers would cycle forever: fail it
+        if (unit.requeues >= TaskQueue::MAX_REQUEUES) {
+            outcome = "unit failed after too many requeues";
+            finish_unit(client, std::vector<bool>(unit.tasks.size(), false));
+        } else {
+            unit.requeues++;
+            pending_.push_front(static_cast<size_t>(client.unit));
+            result_.requeued_units++;
+        }
+        if (options_.log_level <= LogLevel::WARN) {
+            std::cerr << "[coordinator] lost worker "
+                      << (client.name.empty() ? "(unnamed)" : client.name) << " ("
+                      << reason << "), " << outcome << std::endl;
+        }
+    }
+    close(client.fd);
+    clients_.erase(clients_.begin() + index);
+}
+
+// ============================================================================
+// RemoteWorker Implementation
+// ============================================================================
+
+RemoteWorker::RemoteWorker(const ClusterOptions& options)
+    : options_(options), fd_(-1) {
+}
+
+RemoteWorker::~RemoteWorker() {
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+void RemoteWorker::connect_with_retry() {
+    AddressList list;
+    resolve(options_.address, false, list);
+    
+    // The coordinator may still be starting up
+    uint64_t deadline = now_ns() + static_cast<uint64_t>(options_.connect_timeout_ms) * 1000000;
+    int error = 0;
+    while (true) {
+        for (addrinfo* ai = list.head; ai != nullptr; ai = ai->ai_next) {
+            int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd == -1) {
+                error = errno;
+                continue;
+            }
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                set_no_delay(fd);
+                fd_ = fd;
+                return;
+            }
+            error = errno;
+            close(fd);
+        }
+        if (now_ns() >= deadline) {
+            throw std::runtime_error("Failed to connect to " + options_.address + ": " +
+                                     std::string(strerror(error)));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+size_t RemoteWorker::run() {
+    size_t processed = 0;
+    
+    // A connection lost after joining (lease timed out, network blip) is
+    // retried: the unit held then comes back requeued. Refusals, protocol
+    // errors and an unreachable coordinator still throw
+    while (true) {
+        connect_with_retry();
+        bool joined = false;
+        try {
+            serve(processed, joined);
+            return processed;
+        } catch (const ConnectionLost& e) {
+            close(fd_);
+            fd_ = -1;
+            if (!joined) {
+                throw;
+            }
+            if (options_.log_level <= LogLevel::WARN) {
+                std::cerr << "[worker] " << e.what() << ", reconnecting" << std::endl;
+            }
+        }
+    }
+}
+
+void RemoteWorker::serve(size_t& processed, bool& joined) {
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    std::string nonce = random_nonce();
+    WireWriter hello(MSG_HELLO);
+    hello.u32(PROTOCOL_VERSION);
+    hello.raw(nonce);
+    hello.str(std::string(host) + ":" + std::to_string(getpid()));
+    hello.send(fd_);
+    
+    uint8_t type;
+    std::vector<uint8_t> payload;
+    if (!read_frame(fd_, type, payload)) {
+        throw ConnectionLost("Coordinator closed the connection");
+    }
+    if (type == MSG_ERROR) {
+        throw std::runtime_error("Coordinator refused worker: " + WireReader(payload).str());
+    }
+    if (type != MSG_CHALLENGE) {
+        throw std::runtime_error("Unexpected message from coordinator");
+    }
+    std::string challenge = WireReader(payload).raw(NONCE_BYTES);
+    WireWriter auth(MSG_AUTH);
+    auth.digest(key_proof(options_.key, "worker", challenge, nonce));
+    auth.send(fd_);
+    
+    if (!read_frame(fd_, type, payload)) {
+        throw ConnectionLost("Coordinator closed the connection");
+    }
+    if (type == MSG_ERROR) {
+        throw std::runtime_error("Coordinator refused worker: " + WireReader(payload).str());
+    }
+    if (type != MSG_WELCOME) {
+        throw std::runtime_error("Unexpected message from coordinator");
+    }
+    
+    // The coordinator proves the key too: an impostor could otherwise send
+    // chosen data and read the key stream back from the results
+    WireReader welcome(payload);
+    welcome.u8();
+    unsigned int lease_timeout_ms = welcome.u32();
+    if (!Sha256::equal(welcome.digest(),
+                       key_proof(options_.key, "coordinator", challenge, nonce))) {
+        throw std::runtime_error("Coordinator does not hold the same key");
+    }
+    joined = true;
+    
+    // Several PROGRESS frames per lease period, so one delayed frame does
+    // not cost the unit
+    ProgressReporter progress(fd_, lease_timeout_ms / 4);
+    Crypto crypto(options_.key);
+    
+    while (true) {
+        WireWriter request(MSG_REQUEST);
+        progress.send(request);
+        if (!read_frame(fd_, type, payload)) {
+            throw ConnectionLost("Coordinator closed the connection");
+        }
+        WireReader reader(payload);
+        
+        if (type == MSG_BYE) {
+            return;
+        }
+        if (type == MSG_ERROR) {
+            throw std::runtime_error("Coordinator error: " + reader.str());
+        }
+        
+        if (type == MSG_UNIT) {
+            uint64_t unit = reader.u64();
+            uint32_t count = reader.u32();
+            std::vector<TaskSpec> tasks;
+            for (uint32_t i = 0; i < count; ++i) {
+                TaskSpec task;
+                task.type = static_cast<TaskSpec::Type>(reader.u8());
+                task.flags = reader.u32();
+                task.offset = reader.u64();
+                task.length = reader.u64();
+                task.input_file = reader.str();
+                task.output_file = reader.str();
+                task.key = options_.key;
+                tasks.push_back(std::move(task));
+            }
+            
+            // Same per-unit steps as a local pool worker; FileProcessor
+            // beats the heartbeat per chunk
+            progress.begin_unit();
+            std::vector<bool> results;
+            for (const TaskSpec& task : tasks) {
+                results.push_back(FileProcessor::process_file(task));
+            }
+            FileProcessor::commit_durable(tasks, results);
+            
+            WireWriter done(MSG_DONE);
+            done.u64(unit);
+            done.u32(count);
+            for (bool success : results) {
+                done.u8(success ? 1 : 0);
+            }
+            progress.end_unit(done);
+        } else if (type == MSG_CHUNK) {
+            uint64_t unit = reader.u64();
+            reader.u8();    // XOR: encrypt and decrypt are the same pass
+            uint64_t offset = reader.u64();
+            size_t length;
+            const uint8_t* data = reader.rest(length);
+            std::vector<uint8_t> chunk(data, data + length);
+            
+            progress.begin_unit();
+            crypto.seek(offset);
+            crypto.process(chunk.data(), chunk.size());
+            
+            WireWriter done(MSG_CHUNK_DONE);
+            done.u64(unit);
+            done.u8(1);
+            done.raw(chunk.data(), chunk.size());
+            progress.end_unit(done);
+        } else {
+            throw std::runtime_error("Unexpected message from coordinator");
+        }
+        processed++;
+    }
+}
+    
+} // namespace cryptstream
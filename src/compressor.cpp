@@ -0,0 +1,172 @@
+#include "compressor.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace cryptstream {
+
+static constexpr unsigned HASH_BITS = 16;
+static constexpr size_t LAST_LITERALS = 5;     // Matches stop this far from the end
+static constexpr size_t MATCH_LIMIT = 12;      // No match search in the last bytes
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash_sequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t* write_length(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+static bool read_length(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip >= end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+static uint8_t* write_sequence(uint8_t* op, const uint8_t* literals, size_t literal_length,
+                               size_t offset, size_t match_length) {
+    uint8_t* token = op++;
+    *token = static_cast<uint8_t>(std::min<size_t>(literal_length, 15) << 4);
+    if (literal_length >= 15) {
+        op = write_length(op, literal_length - 15);
+    }
+    std::memcpy(op, literals, literal_length);
+    op += literal_length;
+    
+    if (match_length == 0) {
+        return op;  // Final literals-only sequence
+    }
+    
+    *op++ = static_cast<uint8_t>(offset & 0xff);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    size_t extra = match_length - Compressor::MIN_MATCH;
+    *token |= static_cast<uint8_t>(std::min<size_t>(extra, 15));
+    if (extra >= 15) {
+        op = write_length(op, extra - 15);
+    }
+    return op;
+}
+
+size_t Compressor::compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity) {
+    if (capacity < bound(n)) {
+        return 0;
+    }
+    
+    // Positions of the last occurrence of each 4-byte hash
+    thread_local std::vector<uint32_t> table;
+    table.assign(size_t(1) << HASH_BITS, 0);
+    
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + n;
+    uint8_t* op = dst;
+    
+    if (n >= MATCH_LIMIT) {
+        const uint8_t* search_limit = end - MATCH_LIMIT;
+        const uint8_t* match_limit = end - LAST_LITERALS;
+        size_t misses = 0;
+        
+        while (ip <= search_limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t& slot = table[hash_sequence(sequence)];
+            const uint8_t* ref = src + slot;
+            slot = static_cast<uint32_t>(ip - src);
+            
+            if (ref >= ip || static_cast<size_t>(ip - ref) > MAX_OFFSET || read32(ref) != sequence) {
+                // Skip faster through incompressible data
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            
+            size_t length = MIN_MATCH;
+            while (ip + length < match_limit && ref[length] == ip[length]) {
+                length++;
+            }
+            
+            op = write_sequence(op, anchor, ip - anchor, ip - ref, length);
+            ip += length;
+            anchor = ip;
+            misses = 0;
+        }
+    }
+    
+    op = write_sequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+bool Compressor::decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t out_n) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + n;
+    uint8_t* op = dst;
+    uint8_t* out_end = dst + out_n;
+    
+    while (ip < end) {
+        uint8_t token = *ip++;
+        
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(ip, end, literal_length)) {
+            return false;
+        }
+        if (literal_length > static_cast<size_t>(end - ip) ||
+            literal_length > static_cast<size_t>(out_end - op)) {
+            return false;
+        }
+        std::memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+        
+        if (ip == end) {
+            break;  // Final literals-only sequence
+        }
+        
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst)) {
+            return false;
+        }
+        
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(ip, end, match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (match_length > static_cast<size_t>(out_end - op)) {
+            return false;
+        }
+        
+        // Overlapping matches (offset < length) repeat a pattern byte by byte
+        const uint8_t* ref = op - offset;
+        if (offset >= match_length) {
+            std::memcpy(op, ref, match_length);
+        } else {
+            for (size_t i = 0; i < match_length; ++i) {
+                op[i] = ref[i];
+            }
+        }
+        op += match_length;
+    }
+    
+    return op == out_end;
+}
+    
+} // namespace cryptstream
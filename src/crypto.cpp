@@ -28,11 +28,19 @@ void Crypto::decrypt(std::vector<uint8_t>& data) {
 }
 
 void Crypto::process(std::vector<uint8_t>& data) {
+    process(data.data(), data.size());
+}
+
+void Crypto::seek(uint64_t position) {
+    key_index_ = position % key_.size();
+}
+
+void Crypto::process(uint8_t* data, size_t size) {
     // XOR encryption/decryption
-    for (size_t i = 0; i < data.size(); ++i) {
+    for (size_t i = 0; i < size; ++i) {
         data[i] ^= key_[(key_index_ + i) % key_.size()];
     }
-    key_index_ = (key_index_ + data.size()) % key_.size();
+    key_index_ = (key_index_ + size) % key_.size();
 }
 
 } // namespace cryptstream
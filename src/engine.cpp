@@ -0,0 +1,441 @@
+#include "engine.hpp"
+#include "crypto.hpp"
+#include "archive.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <time.h>
+
+namespace cryptstream {
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - since).count();
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static std::future<JobResult> failed_job(const std::string& error,
+                                         const Engine::Callback& on_complete) {
+    JobResult result;
+    result.error = error;
+    if (on_complete) {
+        on_complete(result);
+    }
+    std::promise<JobResult> promise;
+    promise.set_value(result);
+    return promise.get_future();
+}
+
+Engine::Engine(const EngineOptions& options)
+    : options_(options),
+      next_job_id_(1),
+      stopping_(false),
+      stopped_(false) {
+    
+    // Objects of crashed runs would otherwise pile up in /dev/shm
+    remove_stale_ipc(options_.name_prefix);
+    run_name_ = unique_ipc_name(options_.name_prefix);
+    
+    // Create shared memory for task queue
+    shm_.reset(new SharedMemory(run_name_ + "_queue",
+                                sizeof(TaskQueue::QueueData), true, options_.huge_pages));
+    queue_.reset(new TaskQueue(*shm_, true));
+    queue_->set_weights(options_.priority_weights);
+    
+    // Create semaphores
+    task_sem_.reset(new Semaphore(run_name_ + "_task_sem", 0, true));
+    done_sem_.reset(new Semaphore(run_name_ + "_done_sem", 0, true));
+    urgent_sem_.reset(new Semaphore(run_name_ + "_urgent_sem", 0, true));
+    
+    // I/O limits live in their own segment so `throttle <pid>` can map it
+    throttle_shm_.reset(new SharedMemory(run_name_ + "_throttle",
+                                         sizeof(Throttle::State), true));
+    throttle_.reset(new Throttle(*throttle_shm_, true));
+    throttle_->set_limits(options_.io_limits);
+    
+    // Create and start process pool
+    ProcessPool::Options pool_options;
+    pool_options.min_processes = options_.min_processes;
+    pool_options.max_processes = options_.max_processes;
+    pool_options.idle_timeout_ms = options_.idle_timeout_ms;
+    pool_options.lease_timeout_ms = options_.lease_timeout_ms;
+    pool_options.log_level = options_.log_level;
+    pool_options.trace = options_.trace;
+    pool_options.memory_budget = options_.memory_budget;
+    pool_options.chunk_bytes = options_.chunk_bytes;
+    pool_options.prefetch_depth = options_.prefetch_depth;
+    pool_options.drop_cache = options_.drop_cache;
+    pool_options.reserved_workers = options_.reserved_workers;
+    pool_options.throttle = throttle_.get();
+    pool_.reset(new ProcessPool(pool_options, *queue_, *task_sem_, *done_sem_,
+                                urgent_sem_.get()));
+    pool_->start();
+    
+    options_.scheduling.num_workers = options_.max_processes;
+    options_.scheduling.memory_budget = pool_->budget().capacity();
+    dispatcher_ = std::thread(&Engine::dispatch_loop, this);
+}
+
+Engine::~Engine() {
+    try {
+        shutdown();
+    } catch (...) {
+        // Destructors must not throw; IPC objects are released below
+    }
+}
+
+std::future<JobResult> Engine::submit_file(TaskSpec::Type type, const std::string& input,
+                                           const std::string& output, const std::string& key,
+                                           Callback on_complete, TaskSpec::Priority priority) {
+    return submit_batch(type, {{input, output}}, key, std::move(on_complete), priority);
+}
+
+std::future<JobResult> Engine::submit_batch(
+        TaskSpec::Type type, const std::vector<std::pair<std::string, std::string>>& files,
+        const std::string& key, Callback on_complete, TaskSpec::Priority priority) {
+    return submit_planned(type, files, key, task_flags(), priority, std::move(on_complete));
+}
+
+std::future<JobResult> Engine::submit_pack(const std::vector<std::string>& inputs,
+                                           const std::string& archive, const std::string& key,
+                                           Callback on_complete, TaskSpec::Priority priority) {
+    if (key.empty()) {
+        return failed_job("Encryption key cannot be empty", on_complete);
+    }
+    if (!Archive::create(archive)) {
+        return failed_job("Cannot create archive: " + archive, on_complete);
+    }
+    
+    // Every member's output is the archive; workers pick their own segment
+    std::vector<std::pair<std::string, std::string>> files;
+    files.reserve(inputs.size());
+    for (const std::string& input : inputs) {
+        files.emplace_back(input, archive);
+    }
+    return submit_planned(TaskSpec::ENCRYPT, files, key, TaskSpec::FLAG_PACK, priority,
+                          std::move(on_complete), [archive](JobResult& result) {
+        if (!Archive::write_index(archive)) {
+            result.error = "Failed to write archive index";
+        }
+    });
+}
+
+uint32_t Engine::task_flags() const {
+    uint32_t flags = 0;
+    if (options_.huge_pages) {
+        flags |= TaskSpec::FLAG_HUGE_PAGES;
+    }
+    if (options_.durable) {
+        flags |= TaskSpec::FLAG_DURABLE;
+    }
+    if (options_.compress) {
+        flags |= TaskSpec::FLAG_COMPRESS;
+    }
+    if (options_.direct) {
+        flags |= TaskSpec::FLAG_DIRECT;
+    }
+    if (options_.sparse) {
+        flags |= TaskSpec::FLAG_SPARSE;
+    }
+    return flags;
+}
+
+std::future<JobResult> Engine::submit_planned(
+        TaskSpec::Type type, const std::vector<std::pair<std::string, std::string>>& files,
+        const std::string& key, uint32_t flags, TaskSpec::Priority priority,
+        Callback on_complete, Finalizer finalize) {
+    if (key.empty()) {
+        return failed_job("Encryption key cannot be empty", on_complete);
+    }
+    
+    Scheduler scheduler(options_.scheduling);
+    for (const auto& file : files) {
+        scheduler.add(type, file.first, file.second);
+    }
+    
+    std::vector<Scheduler::WorkUnit> planned;
+    try {
+        planned = scheduler.plan(key, flags);
+    } catch (const std::exception& e) {
+        return failed_job(e.what(), on_complete);
+    }
+    
+    JobResult result;
+    result.bytes = scheduler.total_bytes();
+    result.predicted_makespan_ms = scheduler.predicted_makespan_ms();
+    result.lower_bound_ms = scheduler.lower_bound_ms();
+    
+    std::vector<std::vector<TaskSpec>> units;
+    units.reserve(planned.size());
+    for (auto& unit : planned) {
+        units.push_back(std::move(unit.tasks));
+    }
+    return add_job(std::move(units), result, priority, std::move(on_complete),
+                   std::move(finalize));
+}
+
+std::future<JobResult> Engine::submit_range(TaskSpec::Type type, const std::string& input,
+                                            const std::string& output, const std::string& key,
+                                            uint64_t offset, uint64_t length,
+                                            Callback on_complete, TaskSpec::Priority priority) {
+    if (key.empty()) {
+        return failed_job("Encryption key cannot be empty", on_complete);
+    }
+    if (length == 0) {
+        return failed_job("Range length must be non-zero", on_complete);
+    }
+    
+    TaskSpec task;
+    task.type = type;
+    task.input_file = input;
+    task.output_file = output;
+    task.key = key;
+    task.offset = offset;
+    task.length = length;
+    if (options_.huge_pages) {
+        task.flags |= TaskSpec::FLAG_HUGE_PAGES;
+    }
+    
+    JobResult result;
+    result.bytes = length;
+    return add_job({{task}}, result, priority, std::move(on_complete));
+}
+
+std::future<JobResult> Engine::submit_buffer(TaskSpec::Type type, uint8_t* data, size_t size,
+                                             const std::string& key, uint64_t stream_offset,
+                                             Callback on_complete) {
+    (void)type;  // XOR: encrypt and decrypt are the same pass
+    
+    return std::async(std::launch::async, [=]() {
+        auto started = std::chrono::steady_clock::now();
+        JobResult result;
+        result.tasks = 1;
+        result.units = 1;
+        result.bytes = size;
+        try {
+            Crypto crypto(key);
+            crypto.seek(stream_offset);
+            crypto.process(data, size);
+            result.success = true;
+        } catch (const std::exception& e) {
+            result.failed = 1;
+            result.error = e.what();
+        }
+        result.elapsed_ms = elapsed_ms(started);
+        if (on_complete) {
+            on_complete(result);
+        }
+        return result;
+    });
+}
+
+std::future<JobResult> Engine::add_job(std::vector<std::vector<TaskSpec>> units,
+                                       JobResult planned, TaskSpec::Priority priority,
+                                       Callback on_complete, Finalizer finalize) {
+    std::future<JobResult> future;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            throw std::runtime_error("Engine is shutting down");
+        }
+        
+        uint64_t job_id = next_job_id_++;
+        Job& job = jobs_[job_id];
+        job.on_complete = std::move(on_complete);
+        job.finalize = std::move(finalize);
+        job.result = planned;
+        job.result.units = units.size();
+        job.started = std::chrono::steady_clock::now();
+        future = job.promise.get_future();
+        
+        // Queue wait is measured from here, so time in the backlog counts
+        uint64_t submitted_ns = monotonic_ns();
+        for (auto& tasks : units) {
+            for (TaskSpec& task : tasks) {
+                task.tag = job_id;
+                task.priority = priority;
+                task.enqueued_ns = submitted_ns;
+            }
+            job.remaining += tasks.size();
+            pending_[priority].push_back({job_id, std::move(tasks)});
+        }
+        job.result.tasks = job.remaining;
+        
+        if (job.remaining == 0) {
+            job.result.success = true;
+            finish_job(jobs_.find(job_id));
+            return future;
+        }
+    }
+    
+    // Wake the dispatcher; it counts completions, not tokens
+    done_sem_->post();
+    return future;
+}
+
+void Engine::finish_job(std::map<uint64_t, Job>::iterator it) {
+    // Expects mutex_ held; finalizers and callbacks run without it
+    Job job = std::move(it->second);
+    jobs_.erase(it);
+    
+    mutex_.unlock();
+    if (job.finalize) {
+        job.finalize(job.result);
+    }
+    job.result.success = job.result.error.empty() && job.result.failed == 0;
+    job.result.elapsed_ms = elapsed_ms(job.started);
+    if (job.on_complete) {
+        job.on_complete(job.result);
+    }
+    job.promise.set_value(job.result);
+    mutex_.lock();
+}
+
+void Engine::dispatch_loop() {
+    std::vector<TaskQueue::Completion> completions;
+    size_t in_flight = 0;
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        // Resolve finished tasks to their jobs
+        completions.clear();
+        queue_->drain_completions(completions);
+        for (const auto& completion : completions) {
+            in_flight--;
+            auto it = jobs_.find(completion.tag);
+            if (it == jobs_.end()) {
+                continue;
+            }
+            if (!completion.success) {
+                it->second.result.failed++;
+            }
+            if (--it->second.remaining == 0) {
+                finish_job(it);
+            }
+        }
+        
+        // Keep the shared queue topped up from the local backlog, most
+        // urgent class first; each class has its own ring
+        bool backlog = false;
+        for (size_t c = 0; c < TaskQueue::PRIORITY_CLASSES; ++c) {
+            std::deque<PendingUnit>& pending = pending_[c];
+            while (!pending.empty() && queue_->enqueue_bundle(pending.front().tasks)) {
+                in_flight += pending.front().tasks.size();
+                pending.pop_front();
+                task_sem_->post();
+                if (c == TaskSpec::PRIORITY_HIGH) {
+                    urgent_sem_->post();
+                }
+            }
+            backlog = backlog || !pending.empty();
+        }
+        
+        if (backlog && in_flight == 0) {
+            // Drained queue still rejected the unit: it can never fit
+            std::deque<PendingUnit>* stuck = pending_;
+            while (stuck->empty()) {
+                ++stuck;
+            }
+            PendingUnit unit = std::move(stuck->front());
+            stuck->pop_front();
+            auto it = jobs_.find(unit.job_id);
+            if (it != jobs_.end()) {
+                it->second.result.error = "Work unit exceeds task queue capacity";
+                it->second.result.failed += unit.tasks.size();
+                it->second.remaining -= unit.tasks.size();
+                if (it->second.remaining == 0) {
+                    finish_job(it);
+                }
+            }
+            continue;
+        }
+        
+        if (stopping_ && jobs_.empty()) {
+            break;
+        }
+        
+        // Woken by completions, submissions, SIGCHLD, or every 100 ms
+        lock.unlock();
+        pool_->scale();
+        done_sem_->timed_wait(100);
+        lock.lock();
+    }
+}
+
+void Engine::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_) {
+            return;
+        }
+        stopping_ = true;
+    }
+    
+    done_sem_->post();
+    if (dispatcher_.joinable()) {
+        dispatcher_.join();
+    }
+    
+    // Signal shutdown and wait for all workers
+    queue_->signal_shutdown();
+    pool_->signal_workers();
+    final_stats_ = stats();
+    pool_->wait_all();
+    
+    // Cleanup
+    shm_->unlink();
+    task_sem_->unlink();
+    done_sem_->unlink();
+    urgent_sem_->unlink();
+    throttle_shm_->unlink();
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+}
+
+EngineStats Engine::stats() const {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_) {
+            return final_stats_;
+        }
+    }
+    
+    EngineStats stats;
+    stats.peak_workers = pool_->peak_workers();
+    stats.crashed_workers = pool_->crashed_workers();
+    stats.requeued_units = pool_->requeued_units();
+    stats.queue_page_mode = shm_->page_mode();
+    stats.memory_budget = pool_->budget().capacity();
+    stats.peak_buffer_bytes = pool_->budget().peak();
+    stats.chunked_tasks = pool_->budget().chunked_tasks();
+    for (size_t c = 0; c < TaskQueue::PRIORITY_CLASSES; ++c) {
+        stats.queue_wait[c] = queue_->wait_stats(static_cast<TaskSpec::Priority>(c));
+    }
+    for (size_t r = 0; r < Throttle::RESOURCES; ++r) {
+        stats.throttled_ns[r] = throttle_->throttled_ns(static_cast<Throttle::Resource>(r));
+    }
+    return stats;
+}
+
+void Engine::set_limits(const Throttle::Limits& limits) {
+    throttle_->set_limits(limits);
+}
+
+Throttle::Limits Engine::limits() const {
+    return throttle_->limits();
+}
+
+bool Engine::write_trace(const std::string& path) const {
+    if (!pool_->trace()) {
+        std::cerr << "Tracing was not enabled for this engine" << std::endl;
+        return false;
+    }
+    return pool_->trace()->write_chrome_json(path);
+}
+    
+} // namespace cryptstream
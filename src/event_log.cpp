@@ -0,0 +1,238 @@
+#include "event_log.hpp"
+#include "page_buffer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace cryptstream {
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* log_level_name(LogLevel level) {
+    switch (level) {
+        case LogLevel::DEBUG:
+            return "debug";
+        case LogLevel::INFO:
+            return "info";
+        case LogLevel::WARN:
+            return "warn";
+        case LogLevel::ERROR:
+            return "error";
+        case LogLevel::OFF:
+            return "off";
+    }
+    return "unknown";
+}
+
+bool parse_log_level(const std::string& name, LogLevel& level) {
+    static const LogLevel levels[] = {LogLevel::DEBUG, LogLevel::INFO, LogLevel::WARN,
+                                      LogLevel::ERROR, LogLevel::OFF};
+    for (LogLevel candidate : levels) {
+        if (name == log_level_name(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+EventLog::EventLog(size_t rings, LogLevel level)
+    : shm_(sizeof(Ring) * std::max<size_t>(rings, 1)),
+      rings_(static_cast<Ring*>(shm_.get())),
+      ring_count_(std::max<size_t>(rings, 1)),
+      level_(level),
+      epoch_ns_(now_ns()),
+      reported_dropped_(ring_count_, 0) {
+}
+
+void EventLog::fill(LogRecord& record, LogLevel level, LogEvent event, int32_t worker_id,
+                    uint64_t a, uint64_t b, uint64_t c, const std::string* text) {
+    record.timestamp_ns = now_ns();
+    record.args[0] = a;
+    record.args[1] = b;
+    record.args[2] = c;
+    record.worker_id = worker_id;
+    record.event = event;
+    record.level = level;
+    record.reserved = 0;
+    
+    // Keep the end of long paths: the file name is the useful part
+    size_t length = 0;
+    if (text) {
+        length = std::min(text->size(), LogRecord::TEXT_BYTES - 1);
+        std::memcpy(record.text, text->data() + text->size() - length, length);
+    }
+    record.text[length] = '\0';
+}
+
+void EventLog::record(size_t ring, LogLevel level, LogEvent event, int32_t worker_id,
+                      uint64_t a, uint64_t b, uint64_t c, const std::string* text) {
+    if (!enabled(level) || ring >= ring_count_) {
+        return;
+    }
+    
+    Ring& target = rings_[ring];
+    uint64_t head = target.head;    // Only this worker writes head
+    if (head - __atomic_load_n(&target.tail, __ATOMIC_ACQUIRE) >= RING_RECORDS) {
+        __atomic_add_fetch(&target.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    fill(target.records[head % RING_RECORDS], level, event, worker_id, a, b, c, text);
+    
+    // Publish the record after its contents
+    __atomic_store_n(&target.head, head + 1, __ATOMIC_RELEASE);
+}
+
+void EventLog::emit(LogLevel level, LogEvent event, int32_t worker_id,
+                    uint64_t a, uint64_t b, uint64_t c, const std::string& text) {
+    if (!enabled(level)) {
+        return;
+    }
+    
+    drain();
+    std::vector<LogRecord> records(1);
+    fill(records[0], level, event, worker_id, a, b, c, &text);
+    write(records);
+}
+
+size_t EventLog::drain() {
+    std::vector<LogRecord> records;
+    
+    for (size_t i = 0; i < ring_count_; ++i) {
+        Ring& source = rings_[i];
+        uint64_t head = __atomic_load_n(&source.head, __ATOMIC_ACQUIRE);
+        uint64_t tail = source.tail;
+        for (; tail < head; ++tail) {
+            records.push_back(source.records[tail % RING_RECORDS]);
+        }
+        
+        // Hand the slots back to the worker
+        __atomic_store_n(&source.tail, tail, __ATOMIC_RELEASE);
+        
+        uint64_t dropped = __atomic_load_n(&source.dropped, __ATOMIC_RELAXED);
+        if (dropped > reported_dropped_[i]) {
+            LogRecord note;
+            fill(note, LogLevel::WARN, LogEvent::RECORDS_DROPPED, -1,
+                 i, dropped - reported_dropped_[i], 0, nullptr);
+            records.push_back(note);
+            reported_dropped_[i] = dropped;
+        }
+    }
+    
+    if (records.empty()) {
+        return 0;
+    }
+    
+    // Rings are drained one after another; restore global order
+    std::stable_sort(records.begin(), records.end(),
+                     [](const LogRecord& a, const LogRecord& b) {
+                         return a.timestamp_ns < b.timestamp_ns;
+                     });
+    write(records);
+    return records.size();
+}
+
+void EventLog::write(const std::vector<LogRecord>& records) const {
+    char line[256];
+    bool wrote_out = false;
+    bool wrote_err = false;
+    
+    for (const LogRecord& r : records) {
+        double at_ms = (r.timestamp_ns - epoch_ns_) / 1e6;
+        int n = std::snprintf(line, sizeof(line), "[%10.3f ms] ", at_ms);
+        char* text = line + n;
+        size_t room = sizeof(line) - n;
+        unsigned long long a = r.args[0];
+        unsigned long long b = r.args[1];
+        
+        switch (r.event) {
+            case LogEvent::WORKER_STARTED:
+                std::snprintf(text, room, "Worker %d started", r.worker_id);
+                break;
+            case LogEvent::WORKER_SPAWNED:
+                std::snprintf(text, room, "Started worker process %d (PID: %llu)",
+                              r.worker_id, a);
+                break;
+            case LogEvent::WORKER_SHUTDOWN:
+                std::snprintf(text, room, "Worker %d shutting down", r.worker_id);
+                break;
+            case LogEvent::WORKER_RETIRED:
+                std::snprintf(text, room, "Worker %d retiring after %llu ms idle",
+                              r.worker_id, a);
+                break;
+            case LogEvent::WORKER_TERMINATED:
+                std::snprintf(text, room, "Worker %d received termination signal",
+                              r.worker_id);
+                break;
+            case LogEvent::WORKER_EXITING:
+                std::snprintf(text, room, "Worker %d exiting", r.worker_id);
+                break;
+            case LogEvent::WORKER_DIED:
+                std::snprintf(text, room, "Worker process %llu died (%s)%s", a, r.text,
+                              b ? ", requeueing its task" : "");
+                break;
+            case LogEvent::WORKER_HUNG:
+                std::snprintf(text, room, "Worker process %llu missed its heartbeat, killing",
+                              a);
+                break;
+            case LogEvent::UNIT_ABANDONED:
+                std::snprintf(text, room, "Unit failed: its workers died after %llu requeues",
+                              a);
+                break;
+            case LogEvent::FORK_FAILED:
+                std::snprintf(text, room, "Failed to fork worker process %d", r.worker_id);
+                break;
+            case LogEvent::TASK_STARTED:
+                if (b > 0) {
+                    std::snprintf(text, room, "Worker %d processing: %s [%llu, +%llu)",
+                                  r.worker_id, r.text, a, b);
+                } else {
+                    std::snprintf(text, room, "Worker %d processing: %s",
+                                  r.worker_id, r.text);
+                }
+                break;
+            case LogEvent::TASK_COMPLETED:
+                // a holds PageMode + 1 when huge pages were requested
+                if (a > 0) {
+                    std::snprintf(text, room,
+                                  "Worker %d completed task successfully (buffer pages: %s)",
+                                  r.worker_id, page_mode_name(static_cast<PageMode>(a - 1)));
+                } else {
+                    std::snprintf(text, room, "Worker %d completed task successfully",
+                                  r.worker_id);
+                }
+                break;
+            case LogEvent::TASK_FAILED:
+                std::snprintf(text, room, "Worker %d failed to process task: %s",
+                              r.worker_id, r.text);
+                break;
+            case LogEvent::RECORDS_DROPPED:
+                std::snprintf(text, room, "Worker slot %llu dropped %llu log record(s)", a, b);
+                break;
+        }
+        
+        if (r.level >= LogLevel::WARN) {
+            std::cerr << line << '\n';
+            wrote_err = true;
+        } else {
+            std::cout << line << '\n';
+            wrote_out = true;
+        }
+    }
+    
+    // One flush per drain instead of one per line
+    if (wrote_out) {
+        std::cout.flush();
+    }
+    if (wrote_err) {
+        std::cerr.flush();
+    }
+}
+    
+} // namespace cryptstream
@@ -1,47 +1,777 @@
 #include "file_processor.hpp"
+#include "trace.hpp"
+#include "compressor.hpp"
+#include "buffer_pool.hpp"
+#include "archive.hpp"
+#include "throttle.hpp"
+#include "heartbeat.hpp"
 #include <iostream>
+#include <stdexcept>
 #include <sys/stat.h>
+#include <sys/xattr.h>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 namespace cryptstream {
 
-bool FileProcessor::process_file(const Task& task) {
+PageMode FileProcessor::last_page_mode_ = PageMode::STANDARD;
+
+namespace {
+
+/**
+ * Budget bytes held for one task, returned on every exit path
+ */
+class BudgetReservation {
+public:
+    BudgetReservation(MemoryBudget* budget, size_t holder)
+        : budget_(budget), holder_(holder), bytes_(0) {}
+    
+    ~BudgetReservation() {
+        if (bytes_ > 0) {
+            budget_->release(holder_, bytes_);
+        }
+    }
+    
+    bool try_reserve(uint64_t bytes) {
+        if (!budget_->try_acquire(holder_, bytes)) {
+            return false;
+        }
+        bytes_ = bytes;
+        return true;
+    }
+    
+    void reserve(uint64_t bytes) {
+        bytes_ = budget_->acquire(holder_, bytes);
+    }
+
+private:
+    MemoryBudget* budget_;
+    size_t holder_;
+    uint64_t bytes_;
+};
+    
+} // namespace
+
+bool FileProcessor::process_file(const TaskSpec& task, MemoryBudget* budget, size_t holder) {
     try {
+        // Archive members are appended to this worker's segment
+        if (task.flags & TaskSpec::FLAG_PACK) {
+            size_t chunk = budget ? budget->chunk_bytes() : MemoryBudget::DEFAULT_CHUNK_BYTES;
+            BudgetReservation reservation(budget, holder);
+            if (budget) {
+                reservation.reserve(chunk);
+            }
+            return Archive::append(task, holder, chunk);
+        }
+        
         // Open input file with std::move for ownership transfer
+        uint64_t span = TraceBuffer::now();
         std::ifstream input(task.input_file, std::ios::binary);
+        TraceBuffer::record(TraceStage::OPEN, span);
         if (!input.is_open()) {
             std::cerr << "Failed to open input file: " << task.input_file << std::endl;
             return false;
         }
         
+        bool huge_pages = (task.flags & TaskSpec::FLAG_HUGE_PAGES) != 0;
+        bool is_range = task.length > 0;
+        bool durable = (task.flags & TaskSpec::FLAG_DURABLE) && !is_range;
+        bool sparse = (task.flags & TaskSpec::FLAG_SPARSE) != 0;
+        
+        // A plain decrypt would turn the holes of sparse ciphertext into keystream
+        if (!sparse && task.type == TaskSpec::DECRYPT && sparse_marked(task.input_file)) {
+            std::cerr << task.input_file << " was encrypted with --sparse; decrypt it "
+                      << "with --sparse" << std::endl;
+            return false;
+        }
+        
+        // Most paths truncate the output before the input is read; in-place
+        // whole files go through a durable temp (the scheduler sets the flag)
+        if (!is_range && !durable && same_file(task.input_file, task.output_file)) {
+            std::cerr << "Input and output are the same file: " << task.input_file
+                      << std::endl;
+            return false;
+        }
+        std::string output_path = durable ? durable_temp_path(task.output_file)
+                                          : task.output_file;
+        
+        // Compressed streams always go chunk by chunk
+        if (task.flags & TaskSpec::FLAG_COMPRESS) {
+            if (is_range) {
+                std::cerr << "Compressed streams cannot be processed by range: "
+                          << task.input_file << std::endl;
+                return false;
+            }
+            BudgetReservation reservation(budget, holder);
+            if (budget) {
+                reservation.reserve(compress_buffer_bytes());
+            }
+            return process_compressed(task, std::move(input), output_path);
+        }
+        
+        // Sparse files read only their data extents and keep their holes
+        if (sparse) {
+            size_t chunk = budget ? budget->chunk_bytes() : MemoryBudget::DEFAULT_CHUNK_BYTES;
+            chunk = BufferPool::round_up(chunk);
+            BudgetReservation reservation(budget, holder);
+            if (budget) {
+                reservation.reserve(chunk);
+            }
+            bool supported = true;
+            bool success = process_sparse(task, output_path, chunk, supported);
+            if (supported) {
+                return success;
+            }
+        }
+        
+        // Whole plain outputs must not keep the tag of an earlier sparse
+        // output they replace (the scheduler clears pre-sized ones)
+        if (!is_range) {
+            clear_sparse_mark(output_path);
+        }
+        
+        // Direct I/O streams through a pooled chunk; filesystems that reject
+        // O_DIRECT continue on the buffered path below
+        if (task.flags & TaskSpec::FLAG_DIRECT) {
+            size_t chunk = budget ? budget->chunk_bytes() : MemoryBudget::DEFAULT_CHUNK_BYTES;
+            chunk = BufferPool::round_up(chunk);
+            BudgetReservation reservation(budget, holder);
+            if (budget) {
+                reservation.reserve(chunk);
+            }
+            bool supported = true;
+            bool success = process_direct(task, output_path, chunk, supported);
+            if (supported) {
+                return success;
+            }
+        }
+        
+        // Limits are charged per chunk; a whole-file read would be one burst
+        if (Throttle::limited()) {
+            size_t chunk = budget ? budget->chunk_bytes() : MemoryBudget::DEFAULT_CHUNK_BYTES;
+            BudgetReservation reservation(budget, holder);
+            if (budget) {
+                reservation.reserve(chunk);
+            }
+            return process_chunked(task, std::move(input), chunk, output_path);
+        }
+        
+        // Reserve the whole buffer from the pool budget; tasks that do not
+        // fit stream through a chunk-sized reservation instead
+        BudgetReservation reservation(budget, holder);
+        if (budget) {
+            uint64_t need = is_range ? task.length : get_file_size(task.input_file);
+            if (!reservation.try_reserve(need)) {
+                if (need > budget->chunk_bytes()) {
+                    reservation.reserve(budget->chunk_bytes());
+                    budget->count_chunked();
+                    return process_chunked(task, std::move(input), budget->chunk_bytes(),
+                                           output_path);
+                }
+                reservation.reserve(need);
+            }
+        }
+        
         // Read file data using std::move
-        std::vector<uint8_t> data = read_file(std::move(input));
+        Throttle::read(is_range ? task.length : get_file_size(task.input_file));
+        span = TraceBuffer::now();
+        PageBuffer data = is_range
+            ? read_range(std::move(input), task.offset, task.length, huge_pages)
+            : read_file(std::move(input), huge_pages);
+        TraceBuffer::record(TraceStage::READ, span, data.size());
+        last_page_mode_ = data.mode();
         
-        // Create crypto instance
+        // Create crypto instance, positioned at the range start
+        span = TraceBuffer::now();
         Crypto crypto(task.key);
+        crypto.seek(task.offset);
         
-        // Process data based on task type
-        if (task.type == Task::ENCRYPT) {
-            crypto.encrypt(data);
-        } else if (task.type == Task::DECRYPT) {
-            crypto.decrypt(data);
+        // XOR is symmetric: encrypt and decrypt are the same pass
+        if (task.type == TaskSpec::ENCRYPT || task.type == TaskSpec::DECRYPT) {
+            crypto.process(data.data(), data.size());
+        }
+        TraceBuffer::record(TraceStage::CRYPTO, span, data.size());
+        
+        // Ranges update a scheduler pre-sized output in place
+        if (is_range) {
+            span = TraceBuffer::now();
+            std::fstream output(task.output_file,
+                                std::ios::binary | std::ios::in | std::ios::out);
+            TraceBuffer::record(TraceStage::OPEN, span);
+            if (!output.is_open()) {
+                std::cerr << "Failed to open output file: " << task.output_file << std::endl;
+                return false;
+            }
+            Throttle::write(data.size());
+            span = TraceBuffer::now();
+            bool written = write_range(std::move(output), task.offset, data);
+            TraceBuffer::record(TraceStage::WRITE, span, data.size());
+            if (!written) {
+                std::cerr << "Failed to write output file: " << task.output_file << std::endl;
+            }
+            return written;
         }
         
         // Open output file with std::move for ownership transfer
-        std::ofstream output(task.output_file, std::ios::binary);
+        span = TraceBuffer::now();
+        std::ofstream output(output_path, std::ios::binary);
+        TraceBuffer::record(TraceStage::OPEN, span);
         if (!output.is_open()) {
-            std::cerr << "Failed to open output file: " << task.output_file << std::endl;
+            std::cerr << "Failed to open output file: " << output_path << std::endl;
             return false;
         }
         
-        // Write processed data using std::move
-        write_file(std::move(output), data);
+        // Write processed data using std::move (the stream closes inside)
+        Throttle::write(data.size());
+        span = TraceBuffer::now();
+        bool written = write_file(std::move(output), data);
+        TraceBuffer::record(TraceStage::WRITE, span, data.size());
         
-        return true;
+        // A short output fails the task, so a durable commit unlinks the
+        // temp file instead of renaming it over the real one
+        if (!written) {
+            std::cerr << "Failed to write output file: " << output_path << std::endl;
+        }
+        return written;
     } catch (const std::exception& e) {
         std::cerr << "Error processing file: " << e.what() << std::endl;
         return false;
     }
 }
 
+bool FileProcessor::process_chunked(const TaskSpec& task, std::ifstream&& input,
+                                    size_t chunk_bytes, const std::string& output_path) {
+    std::ifstream in = std::move(input);
+    bool huge_pages = (task.flags & TaskSpec::FLAG_HUGE_PAGES) != 0;
+    bool is_range = task.length > 0;
+    uint64_t remaining = is_range ? task.length : get_file_size(task.input_file);
+    
+    // Ranges update the pre-sized output in place, whole files replace it
+    std::ios::openmode mode = std::ios::binary | std::ios::out;
+    mode |= is_range ? std::ios::in : std::ios::trunc;
+    uint64_t span = TraceBuffer::now();
+    std::fstream output(output_path.empty() ? task.output_file : output_path, mode);
+    TraceBuffer::record(TraceStage::OPEN, span);
+    if (!output.is_open()) {
+        std::cerr << "Failed to open output file: " << task.output_file << std::endl;
+        return false;
+    }
+    
+    in.seekg(task.offset, std::ios::beg);
+    output.seekp(is_range ? task.offset : 0, std::ios::beg);
+    
+    // One buffer reused for every chunk; the key stream carries across chunks
+    Crypto crypto(task.key);
+    crypto.seek(task.offset);
+    PageBuffer chunk(std::min<uint64_t>(chunk_bytes, std::max<uint64_t>(remaining, 1)),
+                     huge_pages);
+    last_page_mode_ = chunk.mode();
+    char* bytes = reinterpret_cast<char*>(chunk.data());
+    
+    while (remaining > 0) {
+        size_t n = std::min<uint64_t>(chunk.size(), remaining);
+        Heartbeat::beat();
+        
+        Throttle::read(n);
+        span = TraceBuffer::now();
+        in.read(bytes, n);
+        if (static_cast<size_t>(in.gcount()) != n) {
+            throw std::runtime_error("Short read in chunk");
+        }
+        TraceBuffer::record(TraceStage::READ, span, n);
+        
+        span = TraceBuffer::now();
+        crypto.process(chunk.data(), n);
+        TraceBuffer::record(TraceStage::CRYPTO, span, n);
+        
+        Throttle::write(n);
+        span = TraceBuffer::now();
+        output.write(bytes, n);
+        TraceBuffer::record(TraceStage::WRITE, span, n);
+        
+        remaining -= n;
+    }
+    
+    // Closing flushes the tail; a write that failed there (ENOSPC, EIO)
+    // must fail the task, or a durable commit renames a short file in
+    output.close();
+    return !output.fail();
+}
+
+namespace {
+
+/**
+ * File descriptor closed on every exit path
+ */
+class FileDescriptor {
+public:
+    explicit FileDescriptor(int fd) : fd_(fd) {}
+    ~FileDescriptor() {
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+    
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    
+    int get() const { return fd_; }
+
+private:
+    int fd_;
+};
+
+// Read until n bytes or end of file; returns bytes read, -1 on error
+ssize_t pread_full(int fd, uint8_t* buffer, size_t n, uint64_t offset) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t got = pread(fd, buffer + done, n - done, offset + done);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+bool pwrite_full(int fd, const uint8_t* buffer, size_t n, uint64_t offset) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t put = pwrite(fd, buffer + done, n - done, offset + done);
+        if (put == -1 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return false;
+        }
+        done += put;
+    }
+    return true;
+}
+    
+} // namespace
+
+bool FileProcessor::process_direct(const TaskSpec& task, const std::string& output_path,
+                                   size_t chunk_bytes, bool& supported) {
+    bool is_range = task.length > 0;
+    uint64_t size = is_range ? task.length : get_file_size(task.input_file);
+    supported = false;
+    
+    // Ranges must start on a block boundary (the scheduler aligns its splits)
+    if (task.offset % BufferPool::ALIGNMENT != 0) {
+        return false;
+    }
+    
+    // O_TRUNC below would destroy an input that is also the output
+    if (!is_range && same_file(task.input_file, output_path)) {
+        supported = true;
+        std::cerr << "Input and output are the same file: " << task.input_file << std::endl;
+        return false;
+    }
+    
+    uint64_t span = TraceBuffer::now();
+    FileDescriptor in(open(task.input_file.c_str(), O_RDONLY | O_DIRECT));
+    if (in.get() == -1) {
+        if (errno == EINVAL) {
+            return false;
+        }
+        supported = true;
+        std::cerr << "Failed to open input file: " << task.input_file << std::endl;
+        return false;
+    }
+    
+    int flags = O_WRONLY | O_DIRECT | (is_range ? 0 : O_CREAT | O_TRUNC);
+    FileDescriptor out(open(output_path.c_str(), flags, 0644));
+    TraceBuffer::record(TraceStage::OPEN, span);
+    if (out.get() == -1) {
+        if (errno == EINVAL) {
+            return false;
+        }
+        supported = true;
+        std::cerr << "Failed to open output file: " << output_path << std::endl;
+        return false;
+    }
+    
+    // A padded tail block is cut back with ftruncate, which is only safe
+    // for the range that ends the pre-sized output
+    uint64_t end = task.offset + size;
+    if (is_range && size % BufferPool::ALIGNMENT != 0) {
+        struct stat st;
+        if (fstat(out.get(), &st) == -1 || static_cast<uint64_t>(st.st_size) != end) {
+            return false;
+        }
+    }
+    
+    Crypto crypto(task.key);
+    crypto.seek(task.offset);
+    BufferPool::Buffer buffer =
+        BufferPool::local().acquire(std::min<uint64_t>(chunk_bytes, std::max<uint64_t>(size, 1)));
+    last_page_mode_ = PageMode::STANDARD;
+    
+    uint64_t done = 0;
+    while (done < size) {
+        size_t n = std::min<uint64_t>(buffer.size(), size - done);
+        size_t padded = BufferPool::round_up(n);
+        Heartbeat::beat();
+        
+        Throttle::read(padded);
+        span = TraceBuffer::now();
+        ssize_t got = pread_full(in.get(), buffer.data(), padded, task.offset + done);
+        if (got == -1 && errno == EINVAL && done == 0) {
+            return false;
+        }
+        if (got < static_cast<ssize_t>(n)) {
+            throw std::runtime_error("Short read in direct I/O");
+        }
+        TraceBuffer::record(TraceStage::READ, span, n);
+        
+        span = TraceBuffer::now();
+        crypto.process(buffer.data(), n);
+        TraceBuffer::record(TraceStage::CRYPTO, span, n);
+        
+        // The tail goes out as a whole block; zero the padding past the data
+        Throttle::write(padded);
+        span = TraceBuffer::now();
+        std::memset(buffer.data() + n, 0, padded - n);
+        if (!pwrite_full(out.get(), buffer.data(), padded, task.offset + done)) {
+            if (errno == EINVAL && done == 0) {
+                return false;
+            }
+            throw std::runtime_error("Write failed in direct I/O: " +
+                                     std::string(strerror(errno)));
+        }
+        TraceBuffer::record(TraceStage::WRITE, span, n);
+        
+        done += n;
+    }
+    supported = true;
+    
+    if (size % BufferPool::ALIGNMENT != 0 && ftruncate(out.get(), end) == -1) {
+        std::cerr << "Failed to trim output file: " << output_path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FileProcessor::all_zero(const uint8_t* data, size_t size) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // OR four 16-byte lanes together, one compare per 64 bytes
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= size; i += 64) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(data + i);
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                                   _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF) {
+            return false;
+        }
+    }
+#endif
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        if (word != 0) {
+            return false;
+        }
+    }
+    for (; i < size; ++i) {
+        if (data[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FileProcessor::process_sparse(const TaskSpec& task, const std::string& output_path,
+                                   size_t chunk_bytes, bool& supported) {
+    bool is_range = task.length > 0;
+    uint64_t size = is_range ? task.length : get_file_size(task.input_file);
+    uint64_t end = task.offset + size;
+    
+    // Zero blocks are judged on the file's block grid, so a range must
+    // start on it (the scheduler aligns its splits)
+    supported = task.offset % SPARSE_BLOCK == 0;
+    if (!supported) {
+        return false;
+    }
+    
+    // O_TRUNC below would destroy an input that is also the output
+    if (!is_range && same_file(task.input_file, output_path)) {
+        std::cerr << "Input and output are the same file: " << task.input_file << std::endl;
+        return false;
+    }
+    
+    uint64_t span = TraceBuffer::now();
+    FileDescriptor in(open(task.input_file.c_str(), O_RDONLY));
+    if (in.get() == -1) {
+        std::cerr << "Failed to open input file: " << task.input_file << std::endl;
+        return false;
+    }
+    
+    // Whole files start as one hole of the full size; ranges write into
+    // the output the scheduler pre-sized the same way
+    int flags = O_WRONLY | (is_range ? 0 : O_CREAT | O_TRUNC);
+    FileDescriptor out(open(output_path.c_str(), flags, 0644));
+    TraceBuffer::record(TraceStage::OPEN, span);
+    if (out.get() == -1) {
+        std::cerr << "Failed to open output file: " << output_path << std::endl;
+        return false;
+    }
+    if (!is_range && ftruncate(out.get(), size) == -1) {
+        std::cerr << "Failed to size output file: " << output_path << std::endl;
+        return false;
+    }
+    
+    // Tag sparse ciphertext so a plain decrypt refuses it; the plaintext
+    // written by a sparse decrypt is plain again
+    if (task.type == TaskSpec::ENCRYPT) {
+        static bool warned = false;
+        if (fsetxattr(out.get(), SPARSE_MARK, "1", 1, 0) == -1 && !warned) {
+            warned = true;
+            std::cerr << "Warning: cannot tag sparse output " << output_path << " ("
+                      << strerror(errno) << "); a decrypt without --sparse will not "
+                      << "detect it" << std::endl;
+        }
+    } else {
+        fremovexattr(out.get(), SPARSE_MARK);
+    }
+    
+    Crypto crypto(task.key);
+    chunk_bytes = std::max<size_t>(chunk_bytes - chunk_bytes % SPARSE_BLOCK, SPARSE_BLOCK);
+    BufferPool::Buffer buffer =
+        BufferPool::local().acquire(std::min<uint64_t>(chunk_bytes, std::max<uint64_t>(size, 1)));
+    last_page_mode_ = PageMode::STANDARD;
+    
+    uint64_t position = task.offset;
+    while (position < end) {
+        // Next data extent; filesystems without SEEK_DATA report all data
+        off_t data = lseek(in.get(), position, SEEK_DATA);
+        if (data == -1 && errno == ENXIO) {
+            break;
+        }
+        off_t hole = data == -1 ? -1 : lseek(in.get(), data, SEEK_HOLE);
+        uint64_t extent_start = data == -1 ? position : data;
+        uint64_t extent_end = hole == -1 ? end : std::min<uint64_t>(hole, end);
+        if (extent_start >= end) {
+            break;
+        }
+        
+        // Widen to whole blocks: a block is zero or data as a unit
+        extent_start -= extent_start % SPARSE_BLOCK;
+        extent_start = std::max(extent_start, position);
+        extent_end = std::min<uint64_t>((extent_end + SPARSE_BLOCK - 1) / SPARSE_BLOCK *
+                                        SPARSE_BLOCK, end);
+        
+        for (uint64_t at = extent_start; at < extent_end; ) {
+            size_t n = std::min<uint64_t>(buffer.size(), extent_end - at);
+            Heartbeat::beat();
+            
+            Throttle::read(n);
+            span = TraceBuffer::now();
+            if (pread_full(in.get(), buffer.data(), n, at) != static_cast<ssize_t>(n)) {
+                throw std::runtime_error("Short read in sparse file");
+            }
+            TraceBuffer::record(TraceStage::READ, span, n);
+            
+            // Encrypt each run of non-zero blocks and write it in one call
+            size_t block = 0;
+            while (block < n) {
+                size_t length = std::min(SPARSE_BLOCK, n - block);
+                if (all_zero(buffer.data() + block, length)) {
+                    block += length;
+                    continue;
+                }
+                size_t run = block;
+                while (run < n && !all_zero(buffer.data() + run,
+                                            std::min(SPARSE_BLOCK, n - run))) {
+                    run += std::min(SPARSE_BLOCK, n - run);
+                }
+                
+                span = TraceBuffer::now();
+                crypto.seek(at + block);
+                crypto.process(buffer.data() + block, run - block);
+                TraceBuffer::record(TraceStage::CRYPTO, span, run - block);
+                
+                // Such a block would read back as a hole and decrypt wrong
+                for (size_t check = block; check < run; check += SPARSE_BLOCK) {
+                    if (all_zero(buffer.data() + check, std::min(SPARSE_BLOCK, run - check))) {
+                        std::cerr << "Block at offset " << at + check
+                                  << " becomes all zeros; process " << task.input_file
+                                  << " without --sparse" << std::endl;
+                        return false;
+                    }
+                }
+                
+                Throttle::write(run - block);
+                span = TraceBuffer::now();
+                if (!pwrite_full(out.get(), buffer.data() + block, run - block, at + block)) {
+                    throw std::runtime_error("Write failed in sparse file: " +
+                                             std::string(strerror(errno)));
+                }
+                TraceBuffer::record(TraceStage::WRITE, span, run - block);
+                block = run;
+            }
+            at += n;
+        }
+        position = extent_end;
+    }
+    return true;
+}
+
+static const char COMPRESS_MAGIC[4] = {'C', 'S', 'Z', '1'};
+static constexpr uint32_t FRAME_STORED_RAW = 1u << 31;
+
+static void put32(uint8_t* p, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        p[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+size_t FileProcessor::compress_buffer_bytes() {
+    return COMPRESS_CHUNK_BYTES + Compressor::bound(COMPRESS_CHUNK_BYTES);
+}
+
+bool FileProcessor::process_compressed(const TaskSpec& task, std::ifstream&& input,
+                                       const std::string& output_path) {
+    std::ifstream in = std::move(input);
+    bool huge_pages = (task.flags & TaskSpec::FLAG_HUGE_PAGES) != 0;
+    bool compress = task.type == TaskSpec::ENCRYPT;
+    
+    uint64_t span = TraceBuffer::now();
+    std::ofstream output(output_path, std::ios::binary);
+    TraceBuffer::record(TraceStage::OPEN, span);
+    if (!output.is_open()) {
+        std::cerr << "Failed to open output file: " << output_path << std::endl;
+        return false;
+    }
+    
+    // Stream header: magic and chunk size
+    uint8_t header[8];
+    size_t chunk_bytes = COMPRESS_CHUNK_BYTES;
+    if (compress) {
+        std::memcpy(header, COMPRESS_MAGIC, 4);
+        put32(header + 4, static_cast<uint32_t>(chunk_bytes));
+        output.write(reinterpret_cast<const char*>(header), sizeof(header));
+    } else {
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (in.gcount() != sizeof(header) || std::memcmp(header, COMPRESS_MAGIC, 4) != 0) {
+            std::cerr << "Not a compressed stream: " << task.input_file << std::endl;
+            return false;
+        }
+        chunk_bytes = get32(header + 4);
+        if (chunk_bytes == 0 || chunk_bytes > COMPRESS_CHUNK_BYTES) {
+            throw std::runtime_error("Unsupported chunk size in compressed stream");
+        }
+    }
+    
+    Crypto crypto(task.key);
+    PageBuffer raw(chunk_bytes, huge_pages);
+    PageBuffer packed(Compressor::bound(chunk_bytes), huge_pages);
+    last_page_mode_ = raw.mode();
+    uint64_t raw_offset = 0;
+    uint8_t frame[8];
+    
+    while (true) {
+        uint32_t raw_length;
+        uint32_t stored_length;
+        bool stored_raw;
+        uint8_t* payload;
+        Heartbeat::beat();
+        
+        if (compress) {
+            Throttle::read(chunk_bytes);
+            span = TraceBuffer::now();
+            in.read(reinterpret_cast<char*>(raw.data()), chunk_bytes);
+            raw_length = static_cast<uint32_t>(in.gcount());
+            TraceBuffer::record(TraceStage::READ, span, raw_length);
+            if (raw_length == 0) {
+                break;
+            }
+            
+            // Incompressible chunks are stored as they are
+            span = TraceBuffer::now();
+            stored_length = static_cast<uint32_t>(
+                Compressor::compress(raw.data(), raw_length, packed.data(), packed.size()));
+            TraceBuffer::record(TraceStage::COMPRESS, span, raw_length);
+            stored_raw = stored_length >= raw_length;
+            payload = stored_raw ? raw.data() : packed.data();
+            if (stored_raw) {
+                stored_length = raw_length;
+            }
+        } else {
+            span = TraceBuffer::now();
+            in.read(reinterpret_cast<char*>(frame), sizeof(frame));
+            if (in.gcount() == 0) {
+                break;
+            }
+            if (in.gcount() != sizeof(frame)) {
+                throw std::runtime_error("Truncated frame header");
+            }
+            raw_length = get32(frame);
+            stored_raw = (get32(frame + 4) & FRAME_STORED_RAW) != 0;
+            stored_length = get32(frame + 4) & ~FRAME_STORED_RAW;
+            if (raw_length > chunk_bytes || stored_length > packed.size() ||
+                (stored_raw && stored_length != raw_length)) {
+                throw std::runtime_error("Corrupt frame header");
+            }
+            
+            payload = packed.data();
+            Throttle::read(sizeof(frame) + stored_length);
+            in.read(reinterpret_cast<char*>(payload), stored_length);
+            if (static_cast<uint32_t>(in.gcount()) != stored_length) {
+                throw std::runtime_error("Truncated frame");
+            }
+            TraceBuffer::record(TraceStage::READ, span, stored_length);
+        }
+        
+        // The key stream restarts at the chunk's raw offset in every frame
+        span = TraceBuffer::now();
+        crypto.seek(raw_offset);
+        crypto.process(payload, stored_length);
+        TraceBuffer::record(TraceStage::CRYPTO, span, stored_length);
+        
+        Throttle::write(compress ? sizeof(frame) + stored_length : raw_length);
+        span = TraceBuffer::now();
+        if (compress) {
+            put32(frame, raw_length);
+            put32(frame + 4, stored_length | (stored_raw ? FRAME_STORED_RAW : 0));
+            output.write(reinterpret_cast<const char*>(frame), sizeof(frame));
+            output.write(reinterpret_cast<const char*>(payload), stored_length);
+        } else if (stored_raw) {
+            output.write(reinterpret_cast<const char*>(payload), stored_length);
+        } else {
+            uint64_t expand = TraceBuffer::now();
+            if (!Compressor::decompress(payload, stored_length, raw.data(), raw_length)) {
+                throw std::runtime_error("Corrupt compressed frame");
+            }
+            TraceBuffer::record(TraceStage::COMPRESS, expand, raw_length);
+            span = TraceBuffer::now();
+            output.write(reinterpret_cast<const char*>(raw.data()), raw_length);
+        }
+        TraceBuffer::record(TraceStage::WRITE, span, compress ? stored_length : raw_length);
+        
+        raw_offset += raw_length;
+    }
+    
+    output.close();
+    return !output.fail();
+}
+
 std::vector<uint8_t> FileProcessor::read_file(std::ifstream&& input) {
     // Move ownership of the stream
     std::ifstream file = std::move(input);
@@ -59,14 +789,194 @@ std::vector<uint8_t> FileProcessor::read_file(std::ifstream&& input) {
     return buffer;
 }
 
-void FileProcessor::write_file(std::ofstream&& output, const std::vector<uint8_t>& data) {
+bool FileProcessor::write_file(std::ofstream&& output, const std::vector<uint8_t>& data) {
     // Move ownership of the stream
     std::ofstream file = std::move(output);
     
     // Write data to file
     file.write(reinterpret_cast<const char*>(data.data()), data.size());
     
-    // Stream automatically closed when it goes out of scope
+    // Close here rather than on scope exit, so a failed flush is seen
+    file.close();
+    return !file.fail();
+}
+
+PageBuffer FileProcessor::read_file(std::ifstream&& input, bool huge_pages) {
+    // Move ownership of the stream
+    std::ifstream file = std::move(input);
+    
+    // Get file size
+    file.seekg(0, std::ios::end);
+    size_t size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    
+    // Read entire file into page buffer
+    PageBuffer buffer(size, huge_pages);
+    file.read(reinterpret_cast<char*>(buffer.data()), size);
+    
+    return buffer;
+}
+
+bool FileProcessor::write_file(std::ofstream&& output, const PageBuffer& data) {
+    // Move ownership of the stream
+    std::ofstream file = std::move(output);
+    
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.close();
+    return !file.fail();
+}
+
+PageBuffer FileProcessor::read_range(std::ifstream&& input, uint64_t offset,
+                                     uint64_t length, bool huge_pages) {
+    std::ifstream file = std::move(input);
+    
+    PageBuffer buffer(length, huge_pages);
+    file.seekg(offset, std::ios::beg);
+    file.read(reinterpret_cast<char*>(buffer.data()), length);
+    if (static_cast<uint64_t>(file.gcount()) != length) {
+        throw std::runtime_error("Short read in range");
+    }
+    
+    return buffer;
+}
+
+bool FileProcessor::write_range(std::fstream&& output, uint64_t offset, const PageBuffer& data) {
+    std::fstream file = std::move(output);
+    
+    file.seekp(offset, std::ios::beg);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.close();
+    return !file.fail();
+}
+
+std::string FileProcessor::durable_temp_path(const std::string& output) {
+    size_t slash = output.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "" : output.substr(0, slash + 1);
+    std::string name = slash == std::string::npos ? output : output.substr(slash + 1);
+    return dir + "." + name + ".cryptstream-tmp";
+}
+
+static std::string parent_directory(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+std::vector<bool> FileProcessor::commit_durable(const std::vector<std::string>& outputs) {
+    std::vector<bool> results(outputs.size(), true);
+    if (outputs.empty()) {
+        return results;
+    }
+    uint64_t span = TraceBuffer::now();
+    
+    // 1. Make the data durable: one flush per filesystem covers the group
+    std::vector<dev_t> synced;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        std::string temp = durable_temp_path(outputs[i]);
+        int fd = open(temp.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            results[i] = false;
+            continue;
+        }
+        if (std::find(synced.begin(), synced.end(), st.st_dev) == synced.end()) {
+            int rc = outputs.size() == 1 ? fsync(fd) : syncfs(fd);
+            if (rc == 0) {
+                synced.push_back(st.st_dev);
+            } else {
+                results[i] = false;
+            }
+        }
+        close(fd);
+    }
+    
+    // 2. Atomically replace each output; readers see old or new, never partial
+    std::vector<std::string> directories;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        std::string temp = durable_temp_path(outputs[i]);
+        if (!results[i] || rename(temp.c_str(), outputs[i].c_str()) == -1) {
+            std::cerr << "Failed to commit output file: " << outputs[i] << std::endl;
+            unlink(temp.c_str());
+            results[i] = false;
+            continue;
+        }
+        std::string dir = parent_directory(outputs[i]);
+        if (std::find(directories.begin(), directories.end(), dir) == directories.end()) {
+            directories.push_back(dir);
+        }
+    }
+    
+    // 3. Persist the renames
+    for (const std::string& dir : directories) {
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd != -1) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+    
+    TraceBuffer::record(TraceStage::COMMIT, span, outputs.size());
+    return results;
+}
+
+void FileProcessor::commit_durable(const std::vector<TaskSpec>& tasks,
+                                   std::vector<bool>& results) {
+    std::vector<std::string> outputs;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        if (!(tasks[i].flags & TaskSpec::FLAG_DURABLE) || tasks[i].length > 0) {
+            continue;
+        }
+        if (results[i]) {
+            outputs.push_back(tasks[i].output_file);
+            indices.push_back(i);
+        } else {
+            unlink(durable_temp_path(tasks[i].output_file).c_str());
+        }
+    }
+    
+    std::vector<bool> committed = commit_durable(outputs);
+    for (size_t j = 0; j < indices.size(); ++j) {
+        if (!committed[j]) {
+            results[indices[j]] = false;
+        }
+    }
+}
+
+void FileProcessor::prefetch_input(const TaskSpec& task) {
+    int fd = open(task.input_file.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return;  // The task itself reports the error
+    }
+    uint64_t length = task.length > 0 ? task.length : PREFETCH_MAX_BYTES;
+    posix_fadvise(fd, task.offset, length, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+void FileProcessor::drop_input_cache(const TaskSpec& task) {
+    int fd = open(task.input_file.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    posix_fadvise(fd, task.offset, task.length, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+void FileProcessor::drop_output_cache(const TaskSpec& task) {
+    int fd = open(task.output_file.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    
+    // Dirty pages cannot be dropped; queue them for writeback without waiting
+    sync_file_range(fd, task.offset, task.length, SYNC_FILE_RANGE_WRITE);
+    posix_fadvise(fd, task.offset, task.length, POSIX_FADV_DONTNEED);
+    close(fd);
 }
 
 size_t FileProcessor::get_file_size(const std::string& filepath) {
@@ -77,4 +987,18 @@ size_t FileProcessor::get_file_size(const std::string& filepath) {
     return 0;
 }
 
+bool FileProcessor::sparse_marked(const std::string& path) {
+    return getxattr(path.c_str(), SPARSE_MARK, nullptr, 0) >= 0;
+}
+
+void FileProcessor::clear_sparse_mark(const std::string& path) {
+    removexattr(path.c_str(), SPARSE_MARK);
+}
+
+bool FileProcessor::same_file(const std::string& a, const std::string& b) {
+    struct stat first, second;
+    return stat(a.c_str(), &first) == 0 && stat(b.c_str(), &second) == 0 &&
+           first.st_dev == second.st_dev && first.st_ino == second.st_ino;
+}
+    
 } // namespace cryptstream
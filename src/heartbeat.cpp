@@ -0,0 +1,22 @@
+#include "heartbeat.hpp"
+#include <time.h>
+
+namespace cryptstream {
+
+uint64_t* Heartbeat::stamp_ = nullptr;
+
+void Heartbeat::attach(uint64_t* stamp_ns) {
+    stamp_ = stamp_ns;
+}
+
+void Heartbeat::beat() {
+    if (!stamp_) {
+        return;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    __atomic_store_n(stamp_, now, __ATOMIC_RELAXED);
+}
+    
+} // namespace cryptstream
@@ -3,10 +3,28 @@
 #include "task_queue.hpp"
 #include "process_pool.hpp"
 #include "file_processor.hpp"
+#include "scheduler.hpp"
+#include "engine.hpp"
+#include "trace.hpp"
+#include "cluster.hpp"
+#include "archive.hpp"
+#include "throttle.hpp"
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <stdexcept>
 #include <cstring>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <sys/stat.h>
+#include <errno.h>
 
 using namespace cryptstream;
 
@@ -15,14 +33,56 @@ void print_usage(const char* program_name) {
               << "Commands:\n"
               << "  encrypt <input> <output> --key <key> [--processes N]\n"
               << "  decrypt <input> <output> --key <key> [--processes N]\n"
-              << "  batch <file_list> --key <key> [--processes N]\n\n"
+              << "  batch <file_list> --key <key> [--processes N] [--decrypt]\n"
+              << "  batch <file_list> --key <key> --listen [HOST:]PORT [--stream]\n"
+              << "  worker --connect HOST:PORT --key <key>\n"
+              << "  pack <file_list> <archive> --key <key> [--processes N]\n"
+              << "  unpack <archive> <dir> --key <key>\n"
+              << "  extract <archive> <member> <output> --key <key>\n"
+              << "  throttle <pid> [--max-read-mbps R] [--max-write-mbps W] [--max-iops N]\n\n"
               << "Options:\n"
               << "  --key <key>        Encryption/decryption key (required)\n"
-              << "  --processes N      Number of worker processes (default: 4)\n\n"
+              << "  --processes N      Maximum worker processes (default: 4)\n"
+              << "  --min-processes N  Workers kept alive when idle (default: 1)\n"
+              << "  --idle-timeout MS  Retire workers idle this long (default: never)\n"
+              << "  --lease-timeout MS Kill and requeue a worker silent this long on a task\n"
+              << "  --huge-pages       Back queue and data buffers with huge pages\n"
+              << "  --log-level L      debug, info, warn, error or off (default: info)\n"
+              << "  --quiet            Same as --log-level warn\n"
+              << "  --trace FILE       Write per-stage task spans as Chrome trace JSON\n"
+              << "  --memory-budget N  Data buffer bytes across all workers, K/M/G suffix\n"
+              << "                     (default: half of physical memory)\n"
+              << "  --prefetch N       Queued inputs each worker reads ahead (default: 4, 0 = off)\n"
+              << "  --keep-cache       Leave finished files in the page cache\n"
+              << "  --durable          Crash-safe outputs: temp file, group sync, atomic rename\n"
+              << "  --compress         Compress before encrypting; pass again to decrypt\n"
+              << "  --direct           O_DIRECT I/O, bypassing the page cache\n"
+              << "  --sparse           Read only data extents, keep holes and zero blocks as\n"
+              << "                     holes; pass again to decrypt\n"
+              << "  --decrypt          Batch: decrypt instead of encrypt\n"
+              << "  --listen ADDR      Batch: coordinate remote workers instead of a local pool\n"
+              << "                     (--processes sizes the split for that many workers)\n"
+              << "  --stream           Coordinator: send chunk data, workers need no shared files\n"
+              << "                     (unencrypted on the wire: trusted networks only)\n"
+              << "  --connect ADDR     Worker: pull units from the coordinator at ADDR\n"
+              << "  --priority CLASS   Batch class: high, normal or bulk (default: normal)\n"
+              << "  --urgent LIST      Batch: also run LIST as a high-priority job alongside\n"
+              << "  --reserved-workers N  Workers that only take high-priority work\n"
+              << "  --max-read-mbps R  Read limit across all workers, MB/s (0 = unlimited)\n"
+              << "  --max-write-mbps W Write limit across all workers, MB/s (0 = unlimited)\n"
+              << "  --max-iops N       Read and write calls per second, a whole number\n"
+              << "                     (0 = unlimited)\n\n"
+              << "Batch file list: one \"<input> <output>\" pair per line\n"
+              << "Pack file list: one input path per line; members are named by that path\n"
+              << "Throttle: show or change the limits of a running job started by <pid>;\n"
+              << "          limits not given keep their value\n\n"
               << "Examples:\n"
               << "  " << program_name << " encrypt input.txt output.enc --key mykey\n"
               << "  " << program_name << " decrypt output.enc decrypted.txt --key mykey\n"
-              << "  " << program_name << " batch files.txt --key mykey --processes 8\n";
+              << "  " << program_name << " batch files.txt --key mykey --processes 8\n"
+              << "  " << program_name << " pack files.txt photos.csa --key mykey\n"
+              << "  " << program_name << " extract photos.csa img/001.jpg 001.jpg --key mykey\n"
+              << "  " << program_name << " throttle 4242 --max-write-mbps 50\n";
 }
 
 struct Config {
@@ -31,9 +91,278 @@ struct Config {
     std::string output_file;
     std::string key;
     size_t num_processes = 4;
+    size_t min_processes = 1;
+    unsigned int idle_timeout_ms = 0;
+    unsigned int lease_timeout_ms = 0;
+    bool huge_pages = false;
+    bool decrypt = false;
+    LogLevel log_level = LogLevel::INFO;
+    std::string trace_file;
+    uint64_t memory_budget = 0;
+    size_t prefetch_depth = 4;
+    bool drop_cache = true;
+    bool durable = false;
+    bool compress = false;
+    bool direct = false;
+    bool sparse = false;
+    std::string listen_address;
+    std::string connect_address;
+    bool stream = false;
+    TaskSpec::Priority priority = TaskSpec::PRIORITY_NORMAL;
+    size_t reserved_workers = 0;
+    std::string urgent_list;            // batch: file list run at high priority
+    double max_read_mbps = -1.0;        // I/O limits; negative = not given
+    double max_write_mbps = -1.0;
+    long long max_iops = -1;
+    pid_t throttle_pid = 0;             // throttle: process that started the job
+    std::string member;                 // extract: archive member name
     std::vector<std::pair<std::string, std::string>> file_pairs;
+    std::vector<std::pair<std::string, std::string>> urgent_pairs;
+    std::vector<std::string> members;   // pack: input paths
 };
 
+// Byte count with an optional K, M or G suffix
+bool parse_size(const std::string& text, uint64_t& bytes) {
+    // strtoull accepts a sign and wraps negatives; only digits may lead
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (errno == ERANGE) {
+        return false;
+    }
+    std::string suffix = end;
+    unsigned int shift = 0;
+    if (suffix == "K" || suffix == "k") {
+        shift = 10;
+    } else if (suffix == "M" || suffix == "m") {
+        shift = 20;
+    } else if (suffix == "G" || suffix == "g") {
+        shift = 30;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    if (value > (~0ULL >> shift)) {
+        return false;
+    }
+    bytes = value << shift;
+    return true;
+}
+
+bool parse_priority(const std::string& name, TaskSpec::Priority& priority) {
+    for (size_t c = 0; c < TaskQueue::PRIORITY_CLASSES; ++c) {
+        if (name == priority_name(static_cast<TaskSpec::Priority>(c))) {
+            priority = static_cast<TaskSpec::Priority>(c);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Non-negative rate; fractions allowed
+bool parse_rate(const std::string& text, double& rate) {
+    char* end = nullptr;
+    errno = 0;
+    double value = std::strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || errno == ERANGE || !std::isfinite(value) ||
+        value < 0.0) {
+        return false;
+    }
+    rate = value;
+    return true;
+}
+
+// Whole non-negative number
+bool parse_count(const std::string& text, long long& count) {
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    long long value = std::strtoll(text.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    count = value;
+    return true;
+}
+
+// Whole number in [min, max] into a narrower option field
+template <typename T>
+bool parse_count(const std::string& text, T& field, long long min, long long max) {
+    long long value;
+    if (!parse_count(text, value) || value < min || value > max) {
+        return false;
+    }
+    field = static_cast<T>(value);
+    return true;
+}
+
+// Worker counts past this are typos, not plans (the local pool caps at
+// ProcessPool::MAX_WORKERS; remote coordinators use it as a split hint)
+constexpr long long MAX_PROCESSES = 4096;
+
+// MB/s to bytes per second; a tiny non-zero rate must not round to 0,
+// which would mean unlimited
+uint64_t bytes_per_second(double mbps) {
+    if (mbps == 0.0) {
+        return 0;
+    }
+    return std::max<uint64_t>(1, static_cast<uint64_t>(std::min(mbps * 1e6, 1e18)));
+}
+
+// Merge the limits given on the command line into current ones
+Throttle::Limits apply_limits(const Config& config, Throttle::Limits limits) {
+    if (config.max_read_mbps >= 0.0) {
+        limits.read_bytes = bytes_per_second(config.max_read_mbps);
+    }
+    if (config.max_write_mbps >= 0.0) {
+        limits.write_bytes = bytes_per_second(config.max_write_mbps);
+    }
+    if (config.max_iops >= 0) {
+        limits.operations = static_cast<uint64_t>(config.max_iops);
+    }
+    return limits;
+}
+
+bool has_limits(const Config& config) {
+    Throttle::Limits limits = apply_limits(config, Throttle::Limits());
+    return limits.read_bytes > 0 || limits.write_bytes > 0 || limits.operations > 0;
+}
+
+bool parse_options(int argc, char* argv[], int first, Config& config, bool need_key = true) {
+    for (int i = first; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+            config.key = argv[++i];
+        } else if (std::strcmp(argv[i], "--processes") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], config.num_processes, 1, MAX_PROCESSES)) {
+                std::cerr << "Invalid process count: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--min-processes") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], config.min_processes, 0, MAX_PROCESSES)) {
+                std::cerr << "Invalid minimum process count: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], config.idle_timeout_ms, 0, UINT32_MAX)) {
+                std::cerr << "Invalid idle timeout: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--lease-timeout") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], config.lease_timeout_ms, 0, UINT32_MAX)) {
+                std::cerr << "Invalid lease timeout: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--huge-pages") == 0) {
+            config.huge_pages = true;
+        } else if (std::strcmp(argv[i], "--decrypt") == 0) {
+            config.decrypt = true;
+        } else if (std::strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            if (!parse_size(argv[++i], config.memory_budget)) {
+                std::cerr << "Invalid memory budget: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], config.prefetch_depth, 0, TaskQueue::MAX_TASKS)) {
+                std::cerr << "Invalid prefetch depth: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--keep-cache") == 0) {
+            config.drop_cache = false;
+        } else if (std::strcmp(argv[i], "--durable") == 0) {
+            config.durable = true;
+        } else if (std::strcmp(argv[i], "--compress") == 0) {
+            config.compress = true;
+        } else if (std::strcmp(argv[i], "--direct") == 0) {
+            config.direct = true;
+        } else if (std::strcmp(argv[i], "--sparse") == 0) {
+            config.sparse = true;
+        } else if (std::strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            config.listen_address = argv[++i];
+        } else if (std::strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            config.connect_address = argv[++i];
+        } else if (std::strcmp(argv[i], "--stream") == 0) {
+            config.stream = true;
+        } else if (std::strcmp(argv[i], "--priority") == 0 && i + 1 < argc) {
+            if (!parse_priority(argv[++i], config.priority)) {
+                std::cerr << "Unknown priority class: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--urgent") == 0 && i + 1 < argc) {
+            config.urgent_list = argv[++i];
+        } else if (std::strcmp(argv[i], "--reserved-workers") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], config.reserved_workers, 0, MAX_PROCESSES)) {
+                std::cerr << "Invalid reserved worker count: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--max-read-mbps") == 0 && i + 1 < argc) {
+            if (!parse_rate(argv[++i], config.max_read_mbps)) {
+                std::cerr << "Invalid read limit: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--max-write-mbps") == 0 && i + 1 < argc) {
+            if (!parse_rate(argv[++i], config.max_write_mbps)) {
+                std::cerr << "Invalid write limit: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--max-iops") == 0 && i + 1 < argc) {
+            if (!parse_count(argv[++i], config.max_iops)) {
+                std::cerr << "Invalid IOPS limit: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            config.trace_file = argv[++i];
+        } else if (std::strcmp(argv[i], "--quiet") == 0) {
+            config.log_level = LogLevel::WARN;
+        } else if (std::strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            if (!parse_log_level(argv[++i], config.log_level)) {
+                std::cerr << "Unknown log level: " << argv[i] << std::endl;
+                return false;
+            }
+        }
+    }
+    return !need_key || !config.key.empty();
+}
+
+bool load_file_list(const std::string& path,
+                    std::vector<std::pair<std::string, std::string>>& pairs) {
+    std::ifstream list(path);
+    if (!list.is_open()) {
+        std::cerr << "Failed to open file list: " << path << std::endl;
+        return false;
+    }
+    
+    std::string line;
+    while (std::getline(list, line)) {
+        std::istringstream fields(line);
+        std::string input, output;
+        if (fields >> input >> output) {
+            pairs.emplace_back(input, output);
+        }
+    }
+    return !pairs.empty();
+}
+
+// One path per line; whole lines, so names may contain spaces
+bool load_member_list(const std::string& path, Config& config) {
+    std::ifstream list(path);
+    if (!list.is_open()) {
+        std::cerr << "Failed to open file list: " << path << std::endl;
+        return false;
+    }
+    
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty()) {
+            config.members.push_back(line);
+        }
+    }
+    return !config.members.empty();
+}
+
 bool parse_args(int argc, char* argv[], Config& config) {
     if (argc < 2) {
         return false;
@@ -47,21 +376,440 @@ bool parse_args(int argc, char* argv[], Config& config) {
         }
         config.input_file = argv[2];
         config.output_file = argv[3];
-        
-        for (int i = 4; i < argc; ++i) {
-            if (std::strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
-                config.key = argv[++i];
-            } else if (std::strcmp(argv[i], "--processes") == 0 && i + 1 < argc) {
-                config.num_processes = std::stoi(argv[++i]);
-            }
+        config.decrypt = (config.command == "decrypt");
+        config.file_pairs.emplace_back(config.input_file, config.output_file);
+        return parse_options(argc, argv, 4, config);
+    }
+    
+    if (config.command == "batch") {
+        if (argc < 3) {
+            return false;
         }
-        
-        return !config.key.empty();
+        config.input_file = argv[2];
+        return parse_options(argc, argv, 3, config) &&
+               load_file_list(config.input_file, config.file_pairs) &&
+               (config.urgent_list.empty() ||
+                load_file_list(config.urgent_list, config.urgent_pairs));
+    }
+    
+    if (config.command == "worker") {
+        return parse_options(argc, argv, 2, config) && !config.connect_address.empty();
+    }
+    
+    if (config.command == "pack") {
+        if (argc < 4) {
+            return false;
+        }
+        config.input_file = argv[2];
+        config.output_file = argv[3];
+        return parse_options(argc, argv, 4, config) &&
+               load_member_list(config.input_file, config);
+    }
+    
+    if (config.command == "unpack") {
+        if (argc < 4) {
+            return false;
+        }
+        config.input_file = argv[2];
+        config.output_file = argv[3];
+        return parse_options(argc, argv, 4, config);
+    }
+    
+    if (config.command == "extract") {
+        if (argc < 5) {
+            return false;
+        }
+        config.input_file = argv[2];
+        config.member = argv[3];
+        config.output_file = argv[4];
+        return parse_options(argc, argv, 5, config);
+    }
+    
+    if (config.command == "throttle") {
+        if (argc < 3) {
+            return false;
+        }
+        long long pid = 0;
+        if (!parse_count(argv[2], pid) || pid <= 0 || pid > INT32_MAX) {
+            std::cerr << "Invalid pid: " << argv[2] << std::endl;
+            return false;
+        }
+        config.throttle_pid = static_cast<pid_t>(pid);
+        return parse_options(argc, argv, 3, config, false);
     }
     
     return false;
 }
 
+// Total input and output bytes, to show what compression saved
+void report_sizes(const Config& config) {
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    for (const auto& pair : config.file_pairs) {
+        input_bytes += FileProcessor::get_file_size(pair.first);
+        output_bytes += FileProcessor::get_file_size(pair.second);
+    }
+    std::cout << "Size: " << input_bytes << " -> " << output_bytes << " bytes";
+    if (input_bytes > 0) {
+        std::cout << " (" << (100.0 * output_bytes / input_bytes) << "%)";
+    }
+    std::cout << std::endl;
+}
+
+EngineOptions engine_options(const Config& config) {
+    EngineOptions options;
+    options.min_processes = config.min_processes;
+    options.max_processes = config.num_processes;
+    options.idle_timeout_ms = config.idle_timeout_ms;
+    options.lease_timeout_ms = config.lease_timeout_ms;
+    options.huge_pages = config.huge_pages;
+    options.log_level = config.log_level;
+    options.trace = !config.trace_file.empty();
+    options.memory_budget = config.memory_budget;
+    options.prefetch_depth = config.prefetch_depth;
+    options.drop_cache = config.drop_cache;
+    options.durable = config.durable;
+    options.compress = config.compress;
+    options.direct = config.direct;
+    options.sparse = config.sparse;
+    options.reserved_workers = config.reserved_workers;
+    options.io_limits = apply_limits(config, Throttle::Limits());
+    return options;
+}
+
+// Run all file pairs through the engine's scheduler and process pool
+int run_multiprocess(const Config& config) {
+    TaskSpec::Type type = config.decrypt ? TaskSpec::DECRYPT : TaskSpec::ENCRYPT;
+    EngineOptions options = engine_options(config);
+    bool verbose = config.log_level <= LogLevel::INFO;
+    
+    Engine engine(options);
+    if (config.huge_pages && verbose) {
+        std::cout << "Queue segment pages: "
+                  << page_mode_name(engine.stats().queue_page_mode) << std::endl;
+    }
+    
+    // Plan work units: split giant files, pack small ones, largest first.
+    // An urgent list runs as its own high-class job next to the batch
+    std::future<JobResult> batch = engine.submit_batch(type, config.file_pairs, config.key,
+                                                       nullptr, config.priority);
+    std::future<JobResult> urgent;
+    if (!config.urgent_pairs.empty()) {
+        urgent = engine.submit_batch(type, config.urgent_pairs, config.key, nullptr,
+                                     TaskSpec::PRIORITY_HIGH);
+    }
+    JobResult result = batch.get();
+    bool has_urgent = urgent.valid();
+    JobResult urgent_result;
+    if (has_urgent) {
+        urgent_result = urgent.get();
+    }
+    engine.shutdown();
+    
+    if (options.trace && !engine.write_trace(config.trace_file)) {
+        return 1;
+    }
+    
+    EngineStats stats = engine.stats();
+    if (stats.crashed_workers > 0 && config.log_level <= LogLevel::WARN) {
+        std::cerr << "Recovered from " << stats.crashed_workers << " worker crash(es), "
+                  << stats.requeued_units << " unit(s) requeued" << std::endl;
+    }
+    if (verbose) {
+        std::cout << "Scheduled " << config.file_pairs.size() << " file(s), "
+                  << result.bytes << " bytes as " << result.units
+                  << " work unit(s) / " << result.tasks << " task(s)" << std::endl;
+        std::cout << "Makespan: predicted " << result.predicted_makespan_ms
+                  << " ms (lower bound " << result.lower_bound_ms
+                  << " ms), achieved " << result.elapsed_ms << " ms with up to "
+                  << stats.peak_workers << " worker(s)" << std::endl;
+        std::cout << "Buffers: peak " << stats.peak_buffer_bytes << " of "
+                  << stats.memory_budget << " budget bytes";
+        if (stats.chunked_tasks > 0) {
+            std::cout << ", " << stats.chunked_tasks << " task(s) streamed in chunks";
+        }
+        std::cout << std::endl;
+        if (has_urgent) {
+            std::cout << "Urgent job: " << config.urgent_pairs.size() << " file(s) in "
+                      << urgent_result.elapsed_ms << " ms" << std::endl;
+        }
+        for (size_t c = 0; c < TaskQueue::PRIORITY_CLASSES; ++c) {
+            const TaskQueue::WaitStats& wait = stats.queue_wait[c];
+            if (wait.units == 0) {
+                continue;
+            }
+            std::cout << "Queue wait (" << priority_name(static_cast<TaskSpec::Priority>(c))
+                      << "): " << wait.units << " unit(s), mean " << wait.mean_ms()
+                      << " ms, p99 <= " << wait.percentile_ms(0.99) << " ms, max "
+                      << wait.max_ns / 1e6 << " ms" << std::endl;
+        }
+        const uint64_t* throttled = stats.throttled_ns;
+        if (throttled[Throttle::READ_BYTES] + throttled[Throttle::WRITE_BYTES] +
+            throttled[Throttle::OPERATIONS] > 0) {
+            std::cout << "Throttled: read " << throttled[Throttle::READ_BYTES] / 1e6
+                      << " ms, write " << throttled[Throttle::WRITE_BYTES] / 1e6
+                      << " ms, operations " << throttled[Throttle::OPERATIONS] / 1e6
+                      << " ms of worker time" << std::endl;
+        }
+    }
+    
+    if (has_urgent && !urgent_result.success) {
+        std::cerr << "Urgent job failed"
+                  << (urgent_result.error.empty() ? "" : ": " + urgent_result.error) << std::endl;
+        return 1;
+    }
+    
+    if (!result.error.empty()) {
+        std::cerr << "Error: " << result.error << std::endl;
+    }
+    if (result.failed > 0) {
+        std::cerr << result.failed << " task(s) failed" << std::endl;
+        return 1;
+    }
+    if (!result.success) {
+        return 1;
+    }
+    
+    if (verbose) {
+        if (config.compress) {
+            report_sizes(config);
+        }
+        std::cout << (config.command == "batch" ? "Batch processed successfully!"
+                                                : "File processed successfully!") << std::endl;
+    }
+    return 0;
+}
+
+// Encrypt every listed file into one packed archive
+int run_pack(const Config& config) {
+    EngineOptions options = engine_options(config);
+    bool verbose = config.log_level <= LogLevel::INFO;
+    
+    Engine engine(options);
+    JobResult result = engine.submit_pack(config.members, config.output_file, config.key).get();
+    engine.shutdown();
+    
+    if (options.trace && !engine.write_trace(config.trace_file)) {
+        return 1;
+    }
+    if (!result.error.empty()) {
+        std::cerr << "Error: " << result.error << std::endl;
+    }
+    if (result.failed > 0) {
+        std::cerr << result.failed << " member(s) failed" << std::endl;
+        return 1;
+    }
+    if (!result.success) {
+        return 1;
+    }
+    
+    if (verbose) {
+        ArchiveIndex index(config.output_file);
+        std::cout << "Packed " << index.size() << " member(s), " << result.bytes
+                  << " bytes into " << config.output_file << " in " << result.elapsed_ms
+                  << " ms" << std::endl;
+    }
+    return 0;
+}
+
+// Member names are input paths; keep them inside the target directory
+std::string safe_member_path(const std::string& name) {
+    std::string path;
+    std::istringstream parts(name);
+    std::string part;
+    while (std::getline(parts, part, '/')) {
+        if (part.empty() || part == ".") {
+            continue;
+        }
+        if (part == "..") {
+            return "";
+        }
+        path += path.empty() ? part : "/" + part;
+    }
+    return path;
+}
+
+bool make_parent_dirs(const std::string& path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos;
+         slash = path.find('/', slash + 1)) {
+        std::string dir = path.substr(0, slash);
+        if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+            std::cerr << "Failed to create directory " << dir << ": "
+                      << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decrypt every member of an archive under a directory
+int run_unpack(const Config& config) {
+    ArchiveIndex index(config.input_file);
+    size_t failed = 0;
+    uint64_t bytes = 0;
+    
+    for (size_t i = 0; i < index.size(); ++i) {
+        ArchiveIndex::Member member = index.at(i);
+        std::string relative = safe_member_path(member.name);
+        if (relative.empty()) {
+            std::cerr << "Skipping unsafe member name: " << member.name << std::endl;
+            failed++;
+            continue;
+        }
+        std::string path = config.output_file + "/" + relative;
+        if (!make_parent_dirs(path) || !index.extract(member, config.key, path)) {
+            failed++;
+            continue;
+        }
+        bytes += member.length;
+    }
+    
+    if (failed > 0) {
+        std::cerr << failed << " member(s) failed" << std::endl;
+        return 1;
+    }
+    if (config.log_level <= LogLevel::INFO) {
+        std::cout << "Unpacked " << index.size() << " member(s), " << bytes
+                  << " bytes into " << config.output_file << std::endl;
+    }
+    return 0;
+}
+
+// Decrypt one member, found through the index without reading the others
+int run_extract(const Config& config) {
+    ArchiveIndex index(config.input_file);
+    ArchiveIndex::Member member;
+    if (!index.find(config.member, member)) {
+        std::cerr << "No such member in " << config.input_file << ": "
+                  << config.member << std::endl;
+        return 1;
+    }
+    if (!index.extract(member, config.key, config.output_file)) {
+        return 1;
+    }
+    if (config.log_level <= LogLevel::INFO) {
+        std::cout << "Extracted " << member.name << " (" << member.length
+                  << " bytes)" << std::endl;
+    }
+    return 0;
+}
+
+// "<value> <unit>" or "unlimited"
+std::string describe_rate(uint64_t rate, double scale, const char* unit) {
+    if (rate == 0) {
+        return "unlimited";
+    }
+    std::ostringstream text;
+    text << rate / scale << " " << unit;
+    return text.str();
+}
+
+// Show or change the I/O limits of the jobs a running process started
+int run_throttle(const Config& config) {
+    std::vector<std::string> names = Throttle::find(EngineOptions().name_prefix,
+                                                    config.throttle_pid);
+    if (names.empty()) {
+        std::cerr << "No running job started by pid " << config.throttle_pid << std::endl;
+        return 1;
+    }
+    
+    for (const std::string& name : names) {
+        SharedMemory shm(name, sizeof(Throttle::State), false);
+        Throttle throttle(shm);
+        Throttle::Limits limits = apply_limits(config, throttle.limits());
+        throttle.set_limits(limits);
+        if (config.log_level <= LogLevel::INFO) {
+            std::cout << name.substr(1, name.rfind('_') - 1) << ": read "
+                      << describe_rate(limits.read_bytes, 1e6, "MB/s") << ", write "
+                      << describe_rate(limits.write_bytes, 1e6, "MB/s") << ", operations "
+                      << describe_rate(limits.operations, 1.0, "per second") << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Serve the batch to remote workers over TCP
+int run_coordinator(const Config& config) {
+    if (config.stream && (config.compress || config.durable || config.sparse)) {
+        std::cerr << "--stream supports plain encryption only "
+                  << "(no --compress, --durable or --sparse)" << std::endl;
+        return 1;
+    }
+    if (has_limits(config)) {
+        std::cerr << "--max-read-mbps, --max-write-mbps and --max-iops apply to the "
+                  << "local pool only" << std::endl;
+        return 1;
+    }
+    
+    ClusterOptions options;
+    options.address = config.listen_address;
+    options.key = config.key;
+    options.stream = config.stream;
+    options.workers_hint = config.num_processes;
+    options.lease_timeout_ms = config.lease_timeout_ms;
+    options.log_level = config.log_level;
+    if (config.huge_pages) {
+        options.flags |= TaskSpec::FLAG_HUGE_PAGES;
+    }
+    if (config.durable) {
+        options.flags |= TaskSpec::FLAG_DURABLE;
+    }
+    if (config.compress) {
+        options.flags |= TaskSpec::FLAG_COMPRESS;
+    }
+    if (config.direct) {
+        options.flags |= TaskSpec::FLAG_DIRECT;
+    }
+    if (config.sparse) {
+        options.flags |= TaskSpec::FLAG_SPARSE;
+    }
+    bool verbose = config.log_level <= LogLevel::INFO;
+    
+    Coordinator coordinator(options);
+    uint16_t port = coordinator.listen();
+    if (verbose) {
+        std::cout << "Coordinator listening on port " << port
+                  << (config.stream ? " (streaming data)" : " (shared paths)") << std::endl;
+    }
+    
+    TaskSpec::Type type = config.decrypt ? TaskSpec::DECRYPT : TaskSpec::ENCRYPT;
+    ClusterResult result = coordinator.run(type, config.file_pairs);
+    
+    if (result.lost_workers > 0 && config.log_level <= LogLevel::WARN) {
+        std::cerr << "Lost " << result.lost_workers << " worker(s), "
+                  << result.requeued_units << " unit(s) requeued" << std::endl;
+    }
+    if (verbose) {
+        std::cout << "Distributed " << config.file_pairs.size() << " file(s), "
+                  << result.bytes << " bytes as " << result.units << " work unit(s) / "
+                  << result.tasks << " task(s) to " << result.workers
+                  << " remote worker(s) in " << result.elapsed_ms << " ms" << std::endl;
+    }
+    if (result.failed > 0) {
+        std::cerr << result.failed << " task(s) failed" << std::endl;
+        return 1;
+    }
+    if (verbose) {
+        std::cout << "Batch processed successfully!" << std::endl;
+    }
+    return 0;
+}
+
+// Pull and process units from a coordinator until its batch is done
+int run_worker(const Config& config) {
+    ClusterOptions options;
+    options.address = config.connect_address;
+    options.key = config.key;
+    options.log_level = config.log_level;
+    
+    RemoteWorker worker(options);
+    size_t units = worker.run();
+    if (config.log_level <= LogLevel::INFO) {
+        std::cout << "Worker processed " << units << " unit(s)" << std::endl;
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     Config config;
     
@@ -70,24 +818,93 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
+    bool verbose = config.log_level <= LogLevel::INFO;
+    
     try {
-        // Determine if we should use multi-process or single-threaded
+        if (config.command == "worker") {
+            return run_worker(config);
+        }
+        if (config.command == "batch") {
+            return config.listen_address.empty() ? run_multiprocess(config)
+                                                 : run_coordinator(config);
+        }
+        if (config.command == "pack") {
+            return run_pack(config);
+        }
+        if (config.command == "unpack") {
+            return run_unpack(config);
+        }
+        if (config.command == "extract") {
+            return run_extract(config);
+        }
+        if (config.command == "throttle") {
+            return run_throttle(config);
+        }
+        
+        // Determine if we should use multi-process or single-threaded;
+        // limits are enforced by the pool, so limited runs always use it
         size_t file_size = FileProcessor::get_file_size(config.input_file);
-        bool use_multiprocess = (file_size > 5000 && config.num_processes > 1);
+        bool use_multiprocess = (file_size > 5000 && config.num_processes > 1) ||
+                                has_limits(config);
         
         if (!use_multiprocess) {
             // Single-threaded processing for small files
-            std::cout << "Using single-threaded processing (file size: " 
-                      << file_size << " bytes)" << std::endl;
+            if (verbose) {
+                std::cout << "Using single-threaded processing (file size: "
+                          << file_size << " bytes)" << std::endl;
+            }
+            
+            TaskSpec task;
+            task.type = config.decrypt ? TaskSpec::DECRYPT : TaskSpec::ENCRYPT;
+            task.input_file = config.input_file;
+            task.output_file = config.output_file;
+            task.key = config.key;
+            if (config.huge_pages) {
+                task.flags |= TaskSpec::FLAG_HUGE_PAGES;
+            }
+            // In place: write a temp beside the file and rename it over
+            if (config.durable || FileProcessor::same_file(task.input_file, task.output_file)) {
+                task.flags |= TaskSpec::FLAG_DURABLE;
+            }
+            if (config.compress) {
+                task.flags |= TaskSpec::FLAG_COMPRESS;
+            }
+            if (config.direct) {
+                task.flags |= TaskSpec::FLAG_DIRECT;
+            }
+            if (config.sparse) {
+                task.flags |= TaskSpec::FLAG_SPARSE;
+            }
+            
+            // Trace in-process as worker 0
+            std::unique_ptr<TraceBuffer> trace;
+            if (!config.trace_file.empty()) {
+                trace.reset(new TraceBuffer(1));
+                TraceBuffer::attach(trace.get(), 0, 0);
+            }
             
-            Task task;
-            task.type = (config.command == "encrypt") ? Task::ENCRYPT : Task::DECRYPT;
-            task.set_input(config.input_file);
-            task.set_output(config.output_file);
-            task.set_key(config.key);
+            uint64_t span = TraceBuffer::now();
+            bool success = FileProcessor::process_file(task);
+            TraceBuffer::record(TraceStage::TASK, span);
             
-            if (FileProcessor::process_file(task)) {
-                std::cout << "File processed successfully!" << std::endl;
+            std::vector<bool> results(1, success);
+            FileProcessor::commit_durable({task}, results);
+            success = results[0];
+            if (trace && !trace->write_chrome_json(config.trace_file)) {
+                return 1;
+            }
+            
+            if (success) {
+                if (verbose) {
+                    if (config.huge_pages) {
+                        std::cout << "Buffer pages: "
+                                  << page_mode_name(FileProcessor::last_page_mode()) << std::endl;
+                    }
+                    if (config.compress) {
+                        report_sizes(config);
+                    }
+                    std::cout << "File processed successfully!" << std::endl;
+                }
                 return 0;
             } else {
                 std::cerr << "Failed to process file" << std::endl;
@@ -95,59 +912,13 @@ int main(int argc, char* argv[]) {
             }
         }
         
-        // Multi-process processing
-        std::cout << "Using multi-process processing with " << config.num_processes 
-                  << " workers (file size: " << file_size << " bytes)" << std::endl;
-        
-        // Create shared memory for task queue
-        size_t shm_size = sizeof(TaskQueue::QueueData);
-        SharedMemory shm("/cryptstream_queue", shm_size, true);
-        
-        // Create task queue
-        TaskQueue queue(shm, true);
-        
-        // Create semaphores
-        Semaphore task_sem("/cryptstream_task_sem", 0, true);
-        Semaphore done_sem("/cryptstream_done_sem", 0, true);
-        
-        // Create and start process pool
-        ProcessPool pool(config.num_processes, queue, task_sem, done_sem);
-        pool.start();
-        
-        // Enqueue task
-        Task task;
-        task.type = (config.command == "encrypt") ? Task::ENCRYPT : Task::DECRYPT;
-        task.set_input(config.input_file);
-        task.set_output(config.output_file);
-        task.set_key(config.key);
-        
-        if (!queue.enqueue(task)) {
-            std::cerr << "Failed to enqueue task" << std::endl;
-            return 1;
+        // Multi-process processing; the scheduler splits the file into ranges
+        if (verbose) {
+            std::cout << "Using multi-process processing with " << config.num_processes
+                      << " workers (file size: " << file_size << " bytes)" << std::endl;
         }
         
-        // Signal task availability
-        task_sem.post();
-        
-        // Wait for task completion
-        done_sem.wait();
-        
-        // Signal shutdown
-        queue.signal_shutdown();
-        for (size_t i = 0; i < config.num_processes; ++i) {
-            task_sem.post();
-        }
-        
-        // Wait for all workers
-        pool.wait_all();
-        
-        // Cleanup
-        shm.unlink();
-        task_sem.unlink();
-        done_sem.unlink();
-        
-        std::cout << "File processed successfully!" << std::endl;
-        return 0;
+        return run_multiprocess(config);
         
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
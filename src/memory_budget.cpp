@@ -0,0 +1,124 @@
+#include "memory_budget.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace cryptstream {
+
+MemoryBudget::MemoryBudget(uint64_t capacity, uint64_t chunk_bytes)
+    : shm_(sizeof(State)),
+      state_(static_cast<State*>(shm_.get())),
+      mutex_(&state_->mutex, true) {
+    
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&state_->released, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    state_->capacity = capacity > 0 ? capacity : default_capacity();
+    state_->chunk_bytes = std::max<uint64_t>(std::min(chunk_bytes, state_->capacity), 1);
+}
+
+MemoryBudget::~MemoryBudget() {
+    pthread_cond_destroy(&state_->released);
+}
+
+uint64_t MemoryBudget::default_capacity() {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page_size <= 0) {
+        return 1024ULL * 1024 * 1024;
+    }
+    return static_cast<uint64_t>(pages) * page_size / 2;
+}
+
+uint64_t MemoryBudget::in_use() const {
+    return __atomic_load_n(&state_->in_use, __ATOMIC_RELAXED);
+}
+
+uint64_t MemoryBudget::available() const {
+    uint64_t used = in_use();
+    return used < state_->capacity ? state_->capacity - used : 0;
+}
+
+uint64_t MemoryBudget::peak() const {
+    return __atomic_load_n(&state_->peak, __ATOMIC_RELAXED);
+}
+
+uint64_t MemoryBudget::chunked_tasks() const {
+    return __atomic_load_n(&state_->chunked_tasks, __ATOMIC_RELAXED);
+}
+
+bool MemoryBudget::reserve_locked(size_t holder, uint64_t bytes) {
+    if (state_->in_use + bytes > state_->capacity) {
+        return false;
+    }
+    state_->in_use += bytes;
+    state_->peak = std::max(state_->peak, state_->in_use);
+    if (holder < MAX_HOLDERS) {
+        state_->held[holder] += bytes;
+    }
+    return true;
+}
+
+bool MemoryBudget::try_acquire(size_t holder, uint64_t bytes) {
+    mutex_.lock();
+    bool reserved = reserve_locked(holder, bytes);
+    mutex_.unlock();
+    return reserved;
+}
+
+uint64_t MemoryBudget::acquire(size_t holder, uint64_t bytes) {
+    bytes = std::min(bytes, state_->capacity);
+    
+    mutex_.lock();
+    while (!reserve_locked(holder, bytes)) {
+        // Bounded wait: a crashed holder's bytes come back via the parent
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += 100 * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&state_->released, &state_->mutex, &deadline) == EOWNERDEAD) {
+            pthread_mutex_consistent(&state_->mutex);
+        }
+    }
+    mutex_.unlock();
+    return bytes;
+}
+
+void MemoryBudget::release(size_t holder, uint64_t bytes) {
+    mutex_.lock();
+    bytes = std::min(bytes, state_->in_use);
+    state_->in_use -= bytes;
+    if (holder < MAX_HOLDERS) {
+        state_->held[holder] -= std::min(bytes, state_->held[holder]);
+    }
+    pthread_cond_broadcast(&state_->released);
+    mutex_.unlock();
+}
+
+uint64_t MemoryBudget::release_all(size_t holder) {
+    if (holder >= MAX_HOLDERS) {
+        return 0;
+    }
+    
+    mutex_.lock();
+    uint64_t bytes = state_->held[holder];
+    state_->held[holder] = 0;
+    state_->in_use -= std::min(bytes, state_->in_use);
+    pthread_cond_broadcast(&state_->released);
+    mutex_.unlock();
+    return bytes;
+}
+
+void MemoryBudget::count_chunked() {
+    __atomic_add_fetch(&state_->chunked_tasks, 1, __ATOMIC_RELAXED);
+}
+    
+} // namespace cryptstream
@@ -0,0 +1,146 @@
+#include "page_buffer.hpp"
+#include <fstream>
+#include <string>
+#include <new>
+#include <cstdlib>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace cryptstream {
+
+const char* page_mode_name(PageMode mode) {
+    switch (mode) {
+        case PageMode::STANDARD:         return "standard (4 KB)";
+        case PageMode::TRANSPARENT_HUGE: return "transparent huge (madvise)";
+        case PageMode::HUGETLB_2MB:      return "hugetlb (2 MB)";
+        case PageMode::HUGETLB_1GB:      return "hugetlb (1 GB)";
+    }
+    return "unknown";
+}
+
+bool transparent_huge_pages_available(bool shmem) {
+    // Active setting is the bracketed word, e.g. "always [madvise] never"
+    const char* path = shmem ? "/sys/kernel/mm/transparent_hugepage/shmem_enabled"
+                             : "/sys/kernel/mm/transparent_hugepage/enabled";
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line)) {
+        return false;
+    }
+    
+    size_t open = line.find('[');
+    size_t close = line.find(']', open);
+    if (open == std::string::npos || close == std::string::npos) {
+        return false;
+    }
+    
+    std::string active = line.substr(open + 1, close - open - 1);
+    if (shmem) {
+        return active == "always" || active == "within_size" ||
+               active == "advise" || active == "force";
+    }
+    return active == "always" || active == "madvise";
+}
+
+static size_t round_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+PageBuffer::PageBuffer(size_t size, bool huge_pages) : size_(size) {
+    if (size == 0) {
+        return;
+    }
+    
+    // Small buffers or no huge page request: ordinary heap allocation
+    if (!huge_pages || size < HUGE_PAGE_SIZE) {
+        data_ = static_cast<uint8_t*>(std::malloc(size));
+        if (data_ == nullptr) {
+            throw std::bad_alloc();
+        }
+        return;
+    }
+    
+    const int base_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* ptr = MAP_FAILED;
+    
+    // 1 GB pages only pay off for buffers spanning at least one of them
+    if (size >= GIGANTIC_PAGE_SIZE) {
+        mapped_size_ = round_up(size, GIGANTIC_PAGE_SIZE);
+        ptr = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE,
+                   base_flags | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            mode_ = PageMode::HUGETLB_1GB;
+        }
+    }
+    
+    if (ptr == MAP_FAILED) {
+        mapped_size_ = round_up(size, HUGE_PAGE_SIZE);
+        ptr = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE,
+                   base_flags | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            mode_ = PageMode::HUGETLB_2MB;
+        }
+    }
+    
+    // No reserved huge pages: regular mapping with transparent huge page hint
+    if (ptr == MAP_FAILED) {
+        mapped_size_ = round_up(size, HUGE_PAGE_SIZE);
+        ptr = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, base_flags, -1, 0);
+        if (ptr == MAP_FAILED) {
+            mapped_size_ = 0;
+            throw std::bad_alloc();
+        }
+        if (madvise(ptr, mapped_size_, MADV_HUGEPAGE) == 0 &&
+            transparent_huge_pages_available(false)) {
+            mode_ = PageMode::TRANSPARENT_HUGE;
+        }
+    }
+    
+    data_ = static_cast<uint8_t*>(ptr);
+}
+
+PageBuffer::~PageBuffer() {
+    release();
+}
+
+PageBuffer::PageBuffer(PageBuffer&& other) noexcept
+    : data_(other.data_), size_(other.size_),
+      mapped_size_(other.mapped_size_), mode_(other.mode_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.mapped_size_ = 0;
+}
+
+PageBuffer& PageBuffer::operator=(PageBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        data_ = other.data_;
+        size_ = other.size_;
+        mapped_size_ = other.mapped_size_;
+        mode_ = other.mode_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.mapped_size_ = 0;
+    }
+    return *this;
+}
+
+void PageBuffer::release() {
+    if (data_ == nullptr) {
+        return;
+    }
+    if (mapped_size_ != 0) {
+        munmap(data_, mapped_size_);
+    } else {
+        std::free(data_);
+    }
+    data_ = nullptr;
+}
+
+} // namespace cryptstream
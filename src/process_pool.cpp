@@ -1,6 +1,8 @@
 #include "process_pool.hpp"
 #include "file_processor.hpp"
-#include <iostream>
+#include "heartbeat.hpp"
+#include <algorithm>
+#include <cstring>
 #include <sys/wait.h>
 #include <signal.h>
 #include <chrono>
@@ -8,13 +10,61 @@
 
 namespace cryptstream {
 
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Installed without SA_RESTART: its only job is to interrupt the
+// producer's timed semaphore wait so supervise() runs right away
+static void on_sigchld(int) {
+}
+
+static ProcessPool::Options fixed_size_options(size_t num_processes) {
+    ProcessPool::Options options;
+    options.min_processes = 1;
+    options.max_processes = num_processes;
+    return options;
+}
+
 ProcessPool::ProcessPool(size_t num_processes, TaskQueue& queue,
                          Semaphore& task_sem, Semaphore& done_sem)
-    : num_processes_(num_processes),
+    : ProcessPool(fixed_size_options(num_processes), queue, task_sem, done_sem) {
+}
+
+ProcessPool::ProcessPool(const Options& options, TaskQueue& queue,
+                         Semaphore& task_sem, Semaphore& done_sem, Semaphore* urgent_sem)
+    : options_(options),
       queue_(queue),
       task_sem_(task_sem),
       done_sem_(done_sem),
+      urgent_sem_(urgent_sem),
+      control_shm_(sizeof(PoolControl)),
+      control_(static_cast<PoolControl*>(control_shm_.get())),
+      log_(MAX_WORKERS, options.log_level),
+      budget_(options.memory_budget, options.chunk_bytes),
+      parent_pid_(getpid()),
+      next_worker_id_(0),
+      peak_workers_(0),
+      crashed_workers_(0),
+      requeued_units_(0),
+      fork_ns_total_(0),
+      forks_(0),
       started_(false) {
+    options_.max_processes = std::min(std::max<size_t>(options_.max_processes, 1),
+                                      MAX_WORKERS);
+    options_.min_processes = std::min(options_.min_processes, options_.max_processes);
+    
+    // At least one general worker stays, or only urgent work would run
+    if (urgent_sem_ == nullptr || options_.max_processes < 2) {
+        options_.reserved_workers = 0;
+    }
+    options_.reserved_workers = std::min(options_.reserved_workers, options_.max_processes - 1);
+    options_.min_processes = std::max(options_.min_processes, options_.reserved_workers + 1);
+    if (options_.trace) {
+        trace_.reset(new TraceBuffer(MAX_WORKERS));
+    }
+    std::memset(&previous_sigchld_, 0, sizeof(previous_sigchld_));
 }
 
 ProcessPool::~ProcessPool() {
@@ -28,93 +78,424 @@ void ProcessPool::start() {
         return;
     }
     
-    for (size_t i = 0; i < num_processes_; ++i) {
-        pid_t pid = fork();
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = on_sigchld;
+    action.sa_flags = SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, &previous_sigchld_);
+    
+    started_ = true;
+    
+    // Only the floor is forked up front; scale() adds the rest on demand
+    fill_reserved();
+    while (__atomic_load_n(&control_->live_workers, __ATOMIC_SEQ_CST) < options_.min_processes) {
+        if (!spawn_worker()) {
+            break;
+        }
+    }
+}
+
+bool ProcessPool::spawn_worker() {
+    for (size_t i = options_.reserved_workers; i < MAX_WORKERS; ++i) {
+        // Slots still holding an unrequeued lease are not reused
+        if (control_->slots[i].pid == 0 && !queue_.has_lease(static_cast<int>(i))) {
+            return spawn_worker(i);
+        }
+    }
+    return false;
+}
+
+void ProcessPool::fill_reserved() {
+    for (size_t i = 0; i < options_.reserved_workers; ++i) {
+        if (control_->slots[i].pid == 0 && !queue_.has_lease(static_cast<int>(i))) {
+            spawn_worker(i);
+        }
+    }
+}
+
+bool ProcessPool::spawn_worker(size_t slot) {
+    int worker_id = next_worker_id_++;
+    WorkerSlot& state = control_->slots[slot];
+    state.pid = -1;
+    state.idle = 0;
+    state.heartbeat_ns = now_ns();
+    
+    __atomic_add_fetch(&control_->live_workers, 1, __ATOMIC_SEQ_CST);
+    uint64_t fork_start = now_ns();
+    pid_t pid = fork();
+    
+    if (pid < 0) {
+        __atomic_sub_fetch(&control_->live_workers, 1, __ATOMIC_SEQ_CST);
+        state.pid = 0;
+        log_.emit(LogLevel::ERROR, LogEvent::FORK_FAILED, worker_id);
+        return false;
+    }
+    
+    if (pid == 0) {
+        // Child process
+        sigaction(SIGCHLD, &previous_sigchld_, nullptr);
+        worker_loop(worker_id, slot);
+        exit(0);  // Worker exits when done
+    }
+    
+    // Parent process
+    state.pid = pid;
+    fork_ns_total_ += now_ns() - fork_start;
+    forks_++;
+    peak_workers_ = std::max(peak_workers_, active_workers());
+    log_.emit(LogLevel::INFO, LogEvent::WORKER_SPAWNED, worker_id, pid);
+    return true;
+}
+
+size_t ProcessPool::active_workers() const {
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_WORKERS; ++i) {
+        if (control_->slots[i].pid != 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t ProcessPool::idle_workers() const {
+    size_t count = 0;
+    for (size_t i = options_.reserved_workers; i < MAX_WORKERS; ++i) {
+        if (control_->slots[i].pid > 0 &&
+            __atomic_load_n(&control_->slots[i].idle, __ATOMIC_RELAXED)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void ProcessPool::handle_exit(size_t slot, int status) {
+    WorkerSlot& state = control_->slots[slot];
+    bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    
+    if (!clean) {
+        // A dead worker never decremented the live count itself
+        __atomic_sub_fetch(&control_->live_workers, 1, __ATOMIC_SEQ_CST);
+        crashed_workers_++;
+        log_.emit(LogLevel::WARN, LogEvent::WORKER_DIED, -1, state.pid,
+                  queue_.has_lease(static_cast<int>(slot)), 0,
+                  WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "non-zero exit");
         
-        if (pid < 0) {
-            std::cerr << "Failed to fork worker process " << i << std::endl;
-            continue;
+        // Its buffer reservation died with it
+        budget_.release_all(slot);
+        
+        // It may have consumed a token without dequeuing; one extra post
+        // at worst costs a spurious wake-up
+        if (!queue_.has_lease(static_cast<int>(slot))) {
+            (is_reserved(slot) ? *urgent_sem_ : task_sem_).post();
         }
+    }
+    
+    state.pid = 0;
+    state.idle = 0;
+}
+
+void ProcessPool::supervise() {
+    if (!started_) {
+        return;
+    }
+    
+    log_.drain();
+    
+    uint64_t now = now_ns();
+    for (size_t i = 0; i < MAX_WORKERS; ++i) {
+        WorkerSlot& state = control_->slots[i];
         
-        if (pid == 0) {
-            // Child process
-            worker_loop(i, queue_, task_sem_, done_sem_);
-            exit(0);  // Worker exits when done
-        } else {
-            // Parent process
-            worker_pids_.push_back(pid);
-            std::cout << "Started worker process " << i << " (PID: " << pid << ")" << std::endl;
+        if (state.pid > 0) {
+            int status;
+            if (waitpid(state.pid, &status, WNOHANG) == state.pid) {
+                handle_exit(i, status);
+            } else if (options_.lease_timeout_ms > 0 && queue_.has_lease(static_cast<int>(i)) &&
+                       now - __atomic_load_n(&state.heartbeat_ns, __ATOMIC_RELAXED) >
+                           options_.lease_timeout_ms * 1000000ULL) {
+                // Hung: kill it; the next pass reaps it and requeues
+                log_.emit(LogLevel::WARN, LogEvent::WORKER_HUNG, -1, state.pid);
+                kill(state.pid, SIGKILL);
+            }
+        }
+        
+        // Requeue units of dead workers (retried while the queue is full);
+        // one past its requeue cap completes as failed instead
+        if (state.pid == 0) {
+            switch (queue_.requeue_lease(static_cast<int>(i))) {
+                case TaskQueue::Requeue::REQUEUED:
+                    requeued_units_++;
+                    task_sem_.post();
+                    break;
+                case TaskQueue::Requeue::ABANDONED:
+                    log_.emit(LogLevel::ERROR, LogEvent::UNIT_ABANDONED, -1,
+                              TaskQueue::MAX_REQUEUES);
+                    done_sem_.post();
+                    break;
+                case TaskQueue::Requeue::NONE:
+                    break;
+            }
         }
     }
     
-    started_ = true;
+    // Replace dead workers up to the floor; scale() handles the backlog
+    if (!queue_.is_shutdown()) {
+        fill_reserved();
+        while (__atomic_load_n(&control_->live_workers, __ATOMIC_SEQ_CST) < options_.min_processes) {
+            if (!spawn_worker()) {
+                break;
+            }
+        }
+    }
+}
+
+void ProcessPool::scale() {
+    if (!started_) {
+        return;
+    }
+    
+    supervise();
+    
+    size_t live = __atomic_load_n(&control_->live_workers, __ATOMIC_SEQ_CST);
+    size_t idle = idle_workers();
+    size_t backlog = queue_.size();
+    if (live >= options_.max_processes || backlog <= idle) {
+        return;
+    }
+    
+    // Admission: a worker that cannot reserve even one chunk would only block
+    if (budget_.available() < budget_.chunk_bytes()) {
+        return;
+    }
+    
+    size_t wanted = std::min(backlog - idle, options_.max_processes - live);
+    
+    // Once task time is known, a new worker must get at least a fork's worth of work
+    double task_ms = average_task_ms();
+    if (task_ms > 0.0 && forks_ > 0) {
+        double fork_ms = fork_ns_total_ / 1e6 / forks_;
+        double worth = (backlog * task_ms) / (fork_ms > 0.0 ? fork_ms : 1e-3);
+        wanted = std::min(wanted, static_cast<size_t>(worth));
+    }
+    
+    for (size_t i = 0; i < wanted; ++i) {
+        if (!spawn_worker()) {
+            break;
+        }
+    }
+}
+
+void ProcessPool::signal_workers() {
+    supervise();
+    size_t workers = active_workers();
+    for (size_t i = 0; i < workers; ++i) {
+        task_sem_.post();
+    }
+    for (size_t i = 0; i < options_.reserved_workers; ++i) {
+        urgent_sem_->post();
+    }
+}
+
+double ProcessPool::average_task_ms() const {
+    uint64_t done = __atomic_load_n(&control_->tasks_done, __ATOMIC_RELAXED);
+    if (done == 0) {
+        return 0.0;
+    }
+    return __atomic_load_n(&control_->busy_ns, __ATOMIC_RELAXED) / 1e6 / done;
 }
 
 void ProcessPool::wait_all() {
-    for (pid_t pid : worker_pids_) {
-        int status;
-        waitpid(pid, &status, 0);
+    for (size_t i = 0; i < MAX_WORKERS; ++i) {
+        WorkerSlot& state = control_->slots[i];
+        if (state.pid > 0) {
+            int status;
+            waitpid(state.pid, &status, 0);
+        }
+        state.pid = 0;
+        state.idle = 0;
+    }
+    control_->live_workers = 0;
+    
+    // Last words of the exited workers
+    log_.drain();
+    
+    if (started_) {
+        sigaction(SIGCHLD, &previous_sigchld_, nullptr);
     }
-    worker_pids_.clear();
     started_ = false;
 }
 
 void ProcessPool::terminate() {
     // Send termination signal to all workers
-    for (pid_t pid : worker_pids_) {
-        kill(pid, SIGTERM);
+    for (size_t i = 0; i < MAX_WORKERS; ++i) {
+        if (control_->slots[i].pid > 0) {
+            kill(control_->slots[i].pid, SIGTERM);
+        }
     }
     
     // Wait for workers to terminate
     wait_all();
 }
 
-void ProcessPool::worker_loop(int worker_id, TaskQueue& queue,
-                              Semaphore& task_sem, Semaphore& done_sem) {
-    std::cout << "Worker " << worker_id << " started" << std::endl;
+bool ProcessPool::try_retire() {
+    size_t live = __atomic_load_n(&control_->live_workers, __ATOMIC_SEQ_CST);
+    while (live > options_.min_processes) {
+        if (__atomic_compare_exchange_n(&control_->live_workers, &live, live - 1,
+                                        false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ProcessPool::worker_loop(int worker_id, size_t slot) {
+    log_.record(slot, LogLevel::INFO, LogEvent::WORKER_STARTED, worker_id);
+    TraceBuffer::attach(trace_.get(), slot, worker_id);
+    Throttle::attach(options_.throttle);
+    
+    WorkerSlot& state = control_->slots[slot];
+    Heartbeat::attach(&state.heartbeat_ns);
+    int lease_slot = static_cast<int>(slot);
+    bool reserved = is_reserved(slot);
+    Semaphore& wake_sem = reserved ? *urgent_sem_ : task_sem_;
+    std::vector<TaskSpec> bundle;     // Reused, so dequeues keep string capacity
+    std::vector<TaskSpec> upcoming;
+    TaskSpec written;   // Last output handed to writeback, dropped once clean
+    
+    // Wake periodically while idle: to retire when idle reaping is enabled,
+    // and to leave if the parent died, so a crashed run's segments are not
+    // held open (and kept from remove_stale_ipc) by orphans
+    unsigned int wait_ms = ORPHAN_CHECK_MS;
+    if (options_.idle_timeout_ms > 0) {
+        wait_ms = std::min(wait_ms, options_.idle_timeout_ms);
+    }
+    uint64_t idle_since = now_ns();
     
     while (true) {
         // Wait for task availability
-        task_sem.wait();
+        __atomic_store_n(&state.idle, 1, __ATOMIC_RELAXED);
+        bool woken = wake_sem.timed_wait(wait_ms);
+        __atomic_store_n(&state.idle, 0, __ATOMIC_RELAXED);
         
         // Check if shutdown
-        if (queue.is_shutdown()) {
-            std::cout << "Worker " << worker_id << " shutting down" << std::endl;
+        if (queue_.is_shutdown()) {
+            log_.record(slot, LogLevel::INFO, LogEvent::WORKER_SHUTDOWN, worker_id);
             break;
         }
         
-        // Dequeue task
-        Task task;
-        if (!queue.dequeue(task)) {
-            if (queue.is_shutdown()) {
+        if (!woken) {
+            if (getppid() != parent_pid_) {
+                break;
+            }
+            uint64_t idle_ms = (now_ns() - idle_since) / 1000000;
+            if (options_.idle_timeout_ms > 0 && idle_ms >= options_.idle_timeout_ms &&
+                !reserved && try_retire()) {
+                log_.record(slot, LogLevel::INFO, LogEvent::WORKER_RETIRED, worker_id,
+                            options_.idle_timeout_ms);
+                return;
+            }
+            continue;
+        }
+        
+        // Dequeue task (packed bundles arrive in one round-trip), leased to
+        // this slot; reserved workers only take high-class units
+        if (!queue_.dequeue_bundle(bundle, lease_slot, reserved)) {
+            if (queue_.is_shutdown()) {
                 break;
             }
             continue;
         }
+        if (bundle.empty()) {
+            continue;
+        }
+        uint64_t dequeued_ns = TraceBuffer::now();
         
         // Check for termination task
-        if (task.type == Task::TERMINATE) {
-            std::cout << "Worker " << worker_id << " received termination signal" << std::endl;
+        if (bundle.front().type == TaskSpec::TERMINATE) {
+            queue_.complete_lease(lease_slot, std::vector<bool>(bundle.size(), true));
+            log_.record(slot, LogLevel::INFO, LogEvent::WORKER_TERMINATED, worker_id);
             break;
         }
         
-        // Process the task
-        std::cout << "Worker " << worker_id << " processing: " 
-                  << task.input_file << " -> " << task.output_file << std::endl;
+        uint64_t busy_start = now_ns();
+        __atomic_store_n(&state.heartbeat_ns, busy_start, __ATOMIC_RELAXED);
+        std::vector<bool> results;
+        results.reserve(bundle.size());
         
-        bool success = FileProcessor::process_file(task);
+        // Warm the page cache for what comes next: the rest of this bundle
+        // and the tasks at the queue head no other worker has prefetched.
+        // Direct I/O never reads from the cache, so it skips this
+        if (options_.prefetch_depth > 0 && !(bundle.front().flags & TaskSpec::FLAG_DIRECT)) {
+            for (size_t i = 1; i < bundle.size() && i <= options_.prefetch_depth; ++i) {
+                FileProcessor::prefetch_input(bundle[i]);
+            }
+            if (!reserved) {
+                queue_.claim_prefetch(upcoming, options_.prefetch_depth);
+                for (const TaskSpec& next : upcoming) {
+                    FileProcessor::prefetch_input(next);
+                }
+            }
+        }
         
-        if (success) {
-            std::cout << "Worker " << worker_id << " completed task successfully" << std::endl;
-        } else {
-            std::cerr << "Worker " << worker_id << " failed to process task" << std::endl;
+        for (const TaskSpec& task : bundle) {
+            // Process the task
+            log_.record(slot, LogLevel::DEBUG, LogEvent::TASK_STARTED, worker_id,
+                        task.offset, task.length, 0, &task.input_file);
+            TraceBuffer::record(TraceStage::QUEUE_WAIT, task.enqueued_ns, dequeued_ns, 0);
+            
+            uint64_t span = TraceBuffer::now();
+            bool success = FileProcessor::process_file(task, &budget_, slot);
+            TraceBuffer::record(TraceStage::TASK, span);
+            Heartbeat::beat();
+            results.push_back(success);
+            
+            if (success) {
+                uint64_t pages = 0;
+                if (task.flags & TaskSpec::FLAG_HUGE_PAGES) {
+                    pages = static_cast<uint64_t>(FileProcessor::last_page_mode()) + 1;
+                }
+                log_.record(slot, LogLevel::DEBUG, LogEvent::TASK_COMPLETED, worker_id, pages);
+            } else {
+                log_.record(slot, LogLevel::ERROR, LogEvent::TASK_FAILED, worker_id,
+                            0, 0, 0, &task.input_file);
+            }
         }
         
-        // Signal task completion
-        done_sem.post();
+        // Group commit: one sync covers every durable output of the unit
+        FileProcessor::commit_durable(bundle, results);
+        Heartbeat::beat();
+        
+        // Drop-behind so a large batch does not evict the host's page cache
+        if (options_.drop_cache) {
+            for (size_t i = 0; i < bundle.size(); ++i) {
+                if (!results[i]) {
+                    continue;
+                }
+                FileProcessor::drop_input_cache(bundle[i]);
+                FileProcessor::drop_output_cache(bundle[i]);
+                if (!written.output_file.empty()) {
+                    FileProcessor::drop_output_cache(written);
+                }
+                written = bundle[i];
+            }
+        }
+        
+        // Feed the parent's scaling decisions
+        __atomic_add_fetch(&control_->busy_ns, now_ns() - busy_start, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&control_->tasks_done, bundle.size(), __ATOMIC_RELAXED);
+        
+        // Release the lease, then signal completion of the whole unit
+        queue_.complete_lease(lease_slot, results);
+        done_sem_.post();
+        idle_since = now_ns();
     }
     
-    std::cout << "Worker " << worker_id << " exiting" << std::endl;
+    if (!written.output_file.empty()) {
+        FileProcessor::drop_output_cache(written);
+    }
+    
+    __atomic_sub_fetch(&control_->live_workers, 1, __ATOMIC_SEQ_CST);
+    log_.record(slot, LogLevel::INFO, LogEvent::WORKER_EXITING, worker_id);
 }
-
+    
 } // namespace cryptstream
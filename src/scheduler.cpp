@@ -0,0 +1,162 @@
+#include "scheduler.hpp"
+#include "file_processor.hpp"
+#include "buffer_pool.hpp"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cryptstream {
+
+Scheduler::Scheduler(const Options& options)
+    : options_(options),
+      total_bytes_(0),
+      predicted_makespan_ms_(0.0),
+      lower_bound_ms_(0.0) {
+    if (options_.num_workers == 0) {
+        options_.num_workers = 1;
+    }
+}
+
+void Scheduler::add(TaskSpec::Type type, const std::string& input, const std::string& output) {
+    uint64_t size = FileProcessor::get_file_size(input);
+    jobs_.push_back({type, input, output, size});
+    total_bytes_ += size;
+}
+
+double Scheduler::cost(uint64_t bytes, size_t tasks) const {
+    return tasks * options_.task_overhead_ms + bytes / options_.bytes_per_ms;
+}
+
+std::vector<Scheduler::WorkUnit> Scheduler::plan(const std::string& key, uint32_t flags) {
+    std::vector<WorkUnit> units;
+    
+    // Ranges sized so every worker gets several units of the total
+    uint64_t range_bytes = total_bytes_ / (options_.num_workers * 4);
+    
+    // Small enough that every worker can hold a range within the budget
+    if (options_.memory_budget > 0) {
+        range_bytes = std::min(range_bytes, options_.memory_budget / options_.num_workers);
+    }
+    range_bytes = std::max(range_bytes, options_.min_split_bytes);
+    
+    // Split on block boundaries, so direct I/O ranges start aligned
+    range_bytes = BufferPool::round_up(range_bytes);
+    
+    auto make_task = [&](const Job& job) {
+        TaskSpec task;
+        task.type = job.type;
+        task.input_file = job.input;
+        task.output_file = job.output;
+        task.key = key;
+        task.flags = flags;
+        return task;
+    };
+    
+    WorkUnit pack;
+    auto flush_pack = [&]() {
+        if (!pack.tasks.empty()) {
+            pack.cost_ms = cost(pack.bytes, pack.tasks.size());
+            units.push_back(std::move(pack));
+            pack = WorkUnit();
+        }
+    };
+    
+    // Durable outputs are renamed into place whole, compressed outputs
+    // have no fixed offsets per range, and archive members are appended
+    // whole, so none of them is split
+    bool splittable = options_.num_workers > 1 &&
+                      !(flags & (TaskSpec::FLAG_DURABLE | TaskSpec::FLAG_COMPRESS |
+                                 TaskSpec::FLAG_PACK));
+    
+    for (const Job& job : jobs_) {
+        // In place: never split (ranges would need the output pre-sized, and a
+        // requeued range would re-read its own output); the task writes a temp
+        // beside the file and renames it over the input once done
+        if (FileProcessor::same_file(job.input, job.output)) {
+            WorkUnit unit;
+            TaskSpec task = make_task(job);
+            task.flags |= TaskSpec::FLAG_DURABLE;
+            unit.tasks.push_back(task);
+            unit.bytes = job.size;
+            unit.cost_ms = cost(unit.bytes, 1);
+            units.push_back(std::move(unit));
+        } else if (splittable && job.size >= 2 * range_bytes) {
+            // Split giant file; ranges write in place, so pre-size the output
+            int fd = open(job.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1 || ftruncate(fd, job.size) == -1) {
+                if (fd != -1) {
+                    close(fd);
+                }
+                throw std::runtime_error("Failed to pre-size output " + job.output +
+                                         ": " + std::string(strerror(errno)));
+            }
+            close(fd);
+            if (!(flags & TaskSpec::FLAG_SPARSE)) {
+                FileProcessor::clear_sparse_mark(job.output);
+            }
+            
+            for (uint64_t offset = 0; offset < job.size; offset += range_bytes) {
+                WorkUnit unit;
+                TaskSpec task = make_task(job);
+                task.offset = offset;
+                task.length = std::min(range_bytes, job.size - offset);
+                unit.bytes = task.length;
+                unit.cost_ms = cost(unit.bytes, 1);
+                unit.tasks.push_back(task);
+                units.push_back(std::move(unit));
+            }
+        } else if (job.size < options_.small_file_bytes) {
+            // Pack small files so they share one dequeue round-trip
+            pack.tasks.push_back(make_task(job));
+            pack.bytes += job.size;
+            if (pack.tasks.size() >= options_.max_pack_files ||
+                pack.bytes >= range_bytes) {
+                flush_pack();
+            }
+        } else {
+            WorkUnit unit;
+            unit.tasks.push_back(make_task(job));
+            unit.bytes = job.size;
+            unit.cost_ms = cost(unit.bytes, 1);
+            units.push_back(std::move(unit));
+        }
+    }
+    flush_pack();
+    
+    // Longest-processing-time first
+    std::stable_sort(units.begin(), units.end(),
+                     [](const WorkUnit& a, const WorkUnit& b) { return a.cost_ms > b.cost_ms; });
+    
+    predict(units);
+    return units;
+}
+
+void Scheduler::predict(const std::vector<WorkUnit>& units) {
+    // Greedy list scheduling: each unit goes to the least-loaded worker
+    std::priority_queue<double, std::vector<double>, std::greater<double>> loads;
+    for (size_t i = 0; i < options_.num_workers; ++i) {
+        loads.push(0.0);
+    }
+    
+    double total = 0.0;
+    double largest = 0.0;
+    double makespan = 0.0;
+    for (const WorkUnit& unit : units) {
+        double load = loads.top() + unit.cost_ms;
+        loads.pop();
+        loads.push(load);
+        makespan = std::max(makespan, load);
+        total += unit.cost_ms;
+        largest = std::max(largest, unit.cost_ms);
+    }
+    
+    predicted_makespan_ms_ = makespan;
+    lower_bound_ms_ = std::max(total / options_.num_workers, largest);
+}
+    
+} // namespace cryptstream
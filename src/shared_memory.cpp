@@ -1,25 +1,170 @@
 #include "shared_memory.hpp"
+#include <atomic>
+#include <map>
+#include <sstream>
 #include <stdexcept>
+#include <vector>
 #include <cstring>
+#include <dirent.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <time.h>
 
 namespace cryptstream {
 
+// ============================================================================
+// Per-run IPC names
+// ============================================================================
+
+std::string unique_ipc_name(const std::string& prefix) {
+    static std::atomic<unsigned int> sequence(0);
+    
+    // The pid keeps live runs apart; sequence and clock cover several runs
+    // in one process and a pid reused after a crash
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    
+    std::ostringstream name;
+    name << prefix << "." << getpid() << "." << sequence++ << "-" << std::hex << ns;
+    return name.str();
+}
+
+// Create path exclusively, already holding a shared flock: the object is
+// built under a hidden name remove_stale_ipc ignores and linked into place
+// once locked, so no sweep can see it unlocked; -1 with errno on failure
+static int create_locked(const std::string& dir, const std::string& file) {
+    std::string path = dir + "/" + file;
+    std::string staging = dir + "/." + file;
+    int fd = open(staging.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return -1;
+    }
+    flock(fd, LOCK_SH);
+    
+    // link() fails instead of replacing a name another run already holds
+    int linked = link(staging.c_str(), path.c_str());
+    int error = errno;
+    ::unlink(staging.c_str());
+    if (linked == -1) {
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+// Whether some process still holds the run's queue segment
+static bool ipc_run_alive(const std::string& run) {
+    const std::string queue = "/" + run + "_queue";
+    for (const char* dir : {SHM_DIRECTORY, SharedMemory::HUGETLBFS_MOUNT}) {
+        int fd = open((std::string(dir) + queue).c_str(), O_RDONLY);
+        if (fd == -1) {
+            continue;
+        }
+        bool held = flock(fd, LOCK_EX | LOCK_NB) == -1 && errno == EWOULDBLOCK;
+        close(fd);
+        return held;
+    }
+    return false;
+}
+
+size_t remove_stale_ipc(const std::string& prefix) {
+    std::string base = (prefix[0] == '/' ? prefix.substr(1) : prefix) + ".";
+    size_t removed = 0;
+    
+    for (const char* dir : {SHM_DIRECTORY, SharedMemory::HUGETLBFS_MOUNT}) {
+        DIR* listing = opendir(dir);
+        if (listing == nullptr) {
+            continue;
+        }
+        
+        // Group entries by run; semaphores appear as "sem.<name>"
+        std::map<std::string, std::vector<std::string>> runs;
+        while (struct dirent* entry = readdir(listing)) {
+            std::string file = entry->d_name;
+            std::string object = file.compare(0, 4, "sem.") == 0 ? file.substr(4) : file;
+            if (object.compare(0, base.size(), base) != 0) {
+                continue;
+            }
+            size_t end = object.find('_', base.size());
+            if (end != std::string::npos) {
+                runs[object.substr(0, end)].push_back(file);
+            }
+        }
+        closedir(listing);
+        
+        for (const auto& run : runs) {
+            if (ipc_run_alive(run.first)) {
+                continue;
+            }
+            for (const std::string& file : run.second) {
+                if (::unlink((std::string(dir) + "/" + file).c_str()) == 0) {
+                    removed++;
+                }
+            }
+        }
+    }
+    return removed;
+}
+
+std::vector<std::string> live_ipc_runs(const std::string& prefix, pid_t pid) {
+    std::string base = prefix + "." + std::to_string(pid) + ".";
+    std::string file_base = base[0] == '/' ? base.substr(1) : base;
+    const std::string suffix = "_queue";
+    std::vector<std::string> runs;
+    
+    for (const char* dir : {SHM_DIRECTORY, SharedMemory::HUGETLBFS_MOUNT}) {
+        DIR* listing = opendir(dir);
+        if (listing == nullptr) {
+            continue;
+        }
+        while (struct dirent* entry = readdir(listing)) {
+            std::string file = entry->d_name;
+            if (file.compare(0, file_base.size(), file_base) != 0 ||
+                file.size() <= suffix.size() ||
+                file.compare(file.size() - suffix.size(), suffix.size(), suffix) != 0) {
+                continue;
+            }
+            std::string run = file.substr(0, file.size() - suffix.size());
+            if (ipc_run_alive(run)) {
+                runs.push_back("/" + run);
+            }
+        }
+        closedir(listing);
+    }
+    return runs;
+}
+
 // ============================================================================
 // SharedMemory Implementation
 // ============================================================================
 
-SharedMemory::SharedMemory(const std::string& name, size_t size, bool create)
-    : name_(name), ptr_(nullptr), size_(size), fd_(-1), owner_(create) {
+SharedMemory::SharedMemory(const std::string& name, size_t size, bool create,
+                           bool huge_pages)
+    : name_(name), ptr_(nullptr), size_(size), mapped_size_(size), fd_(-1),
+      owner_(create), page_mode_(PageMode::STANDARD) {
     
-    int flags = create ? (O_CREAT | O_RDWR) : O_RDWR;
-    mode_t mode = S_IRUSR | S_IWUSR;
+    // Prefer explicit huge pages when a hugetlbfs mount has pages reserved
+    if (huge_pages && map_hugetlbfs(create)) {
+        if (create) {
+            std::memset(ptr_, 0, size_);
+        }
+        return;
+    }
     
-    // Open or create shared memory object
-    fd_ = shm_open(name_.c_str(), flags, mode);
+    // Open or create shared memory object; never adopt another run's segment.
+    // A created segment is flocked before it appears, marking the run live
+    // for remove_stale_ipc
+    if (create) {
+        fd_ = create_locked(SHM_DIRECTORY, name_[0] == '/' ? name_.substr(1) : name_);
+    } else {
+        fd_ = shm_open(name_.c_str(), O_RDWR, S_IRUSR | S_IWUSR);
+    }
     if (fd_ == -1) {
-        throw std::runtime_error("Failed to open shared memory: " + 
+        throw std::runtime_error("Failed to open shared memory " + name_ + ": " +
                                  std::string(strerror(errno)));
     }
     
@@ -44,15 +189,73 @@ SharedMemory::SharedMemory(const std::string& name, size_t size, bool create)
                                  std::string(strerror(errno)));
     }
     
+    // Transparent fallback: only effective if shmem THP is enabled
+    if (huge_pages && madvise(ptr_, size_, MADV_HUGEPAGE) == 0 &&
+        transparent_huge_pages_available(true)) {
+        page_mode_ = PageMode::TRANSPARENT_HUGE;
+    }
+    
     // Initialize memory to zero if creating
     if (create) {
         std::memset(ptr_, 0, size_);
     }
 }
 
+SharedMemory::SharedMemory(size_t size)
+    : ptr_(nullptr), size_(size), mapped_size_(size), fd_(-1), owner_(false),
+      page_mode_(PageMode::STANDARD) {
+    
+    // Anonymous memory is zero-filled by the kernel
+    ptr_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ptr_ == MAP_FAILED) {
+        throw std::runtime_error("Failed to map anonymous shared memory: " + 
+                                 std::string(strerror(errno)));
+    }
+}
+
+bool SharedMemory::map_hugetlbfs(bool create) {
+    struct stat st;
+    if (stat(HUGETLBFS_MOUNT, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+    
+    std::string file = name_[0] == '/' ? name_.substr(1) : name_;
+    std::string path = std::string(HUGETLBFS_MOUNT) + "/" + file;
+    int fd = create ? create_locked(HUGETLBFS_MOUNT, file) : open(path.c_str(), O_RDWR);
+    if (fd == -1) {
+        return false;
+    }
+    
+    // hugetlbfs mappings must cover whole huge pages
+    size_t mapped = (size_ + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if (create && ftruncate(fd, mapped) == -1) {
+        close(fd);
+        ::unlink(path.c_str());
+        return false;
+    }
+    
+    void* ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        // Typically no free pages in the pool
+        close(fd);
+        if (create) {
+            ::unlink(path.c_str());
+        }
+        return false;
+    }
+    
+    fd_ = fd;
+    ptr_ = ptr;
+    mapped_size_ = mapped;
+    hugetlb_path_ = path;
+    page_mode_ = PageMode::HUGETLB_2MB;
+    return true;
+}
+
 SharedMemory::~SharedMemory() {
     if (ptr_ != nullptr && ptr_ != MAP_FAILED) {
-        munmap(ptr_, size_);
+        munmap(ptr_, mapped_size_);
     }
     if (fd_ != -1) {
         close(fd_);
@@ -61,7 +264,11 @@ SharedMemory::~SharedMemory() {
 
 void SharedMemory::unlink() {
     if (owner_) {
-        shm_unlink(name_.c_str());
+        if (!hugetlb_path_.empty()) {
+            ::unlink(hugetlb_path_.c_str());
+        } else {
+            shm_unlink(name_.c_str());
+        }
     }
 }
 
@@ -73,20 +280,15 @@ Semaphore::Semaphore(const std::string& name, unsigned int initial_value, bool c
     : name_(name), sem_(nullptr), owner_(create) {
     
     if (create) {
-        // Create new semaphore
-        sem_ = sem_open(name_.c_str(), O_CREAT | O_EXCL, 0644, initial_value);
-        if (sem_ == SEM_FAILED) {
-            // If already exists, unlink and try again
-            sem_unlink(name_.c_str());
-            sem_ = sem_open(name_.c_str(), O_CREAT | O_EXCL, 0644, initial_value);
-        }
+        // Create new semaphore; an existing one belongs to another run
+        sem_ = sem_open(name_.c_str(), O_CREAT | O_EXCL, 0600, initial_value);
     } else {
         // Open existing semaphore
         sem_ = sem_open(name_.c_str(), 0);
     }
     
     if (sem_ == SEM_FAILED) {
-        throw std::runtime_error("Failed to open semaphore: " + 
+        throw std::runtime_error("Failed to open semaphore " + name_ + ": " +
                                  std::string(strerror(errno)));
     }
 }
@@ -115,6 +317,26 @@ bool Semaphore::try_wait() {
     return sem_trywait(sem_) == 0;
 }
 
+bool Semaphore::timed_wait(unsigned int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += static_cast<long>(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    
+    if (sem_timedwait(sem_, &deadline) == 0) {
+        return true;
+    }
+    if (errno == ETIMEDOUT || errno == EINTR) {
+        return false;
+    }
+    throw std::runtime_error("Semaphore timed wait failed: " + 
+                             std::string(strerror(errno)));
+}
+
 void Semaphore::unlink() {
     if (owner_) {
         sem_unlink(name_.c_str());
@@ -135,6 +357,9 @@ SharedMutex::SharedMutex(pthread_mutex_t* mutex, bool initialize)
         // Set mutex to be shared between processes
         pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
         
+        // A worker killed inside a critical section must not deadlock the pool
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        
         // Initialize the mutex
         pthread_mutex_init(mutex_, &attr);
         
@@ -142,8 +367,20 @@ SharedMutex::SharedMutex(pthread_mutex_t* mutex, bool initialize)
     }
 }
 
+bool SharedMutex::acquired(int result) {
+    if (result == 0) {
+        return true;
+    }
+    if (result == EOWNERDEAD) {
+        // Previous owner died; protected data is published last-store-wins
+        pthread_mutex_consistent(mutex_);
+        return true;
+    }
+    return false;
+}
+
 void SharedMutex::lock() {
-    if (pthread_mutex_lock(mutex_) != 0) {
+    if (!acquired(pthread_mutex_lock(mutex_))) {
         throw std::runtime_error("Mutex lock failed");
     }
 }
@@ -155,7 +392,7 @@ void SharedMutex::unlock() {
 }
 
 bool SharedMutex::try_lock() {
-    return pthread_mutex_trylock(mutex_) == 0;
+    return acquired(pthread_mutex_trylock(mutex_));
 }
-
+    
 } // namespace cryptstream
@@ -1,66 +1,479 @@
 #include "task_queue.hpp"
+#include <algorithm>
 #include <stdexcept>
+#include <time.h>
 
 namespace cryptstream {
 
+constexpr uint32_t TaskQueue::DEFAULT_WEIGHTS[TaskQueue::PRIORITY_CLASSES];
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+const char* priority_name(TaskSpec::Priority priority) {
+    switch (priority) {
+        case TaskSpec::PRIORITY_HIGH: return "high";
+        case TaskSpec::PRIORITY_NORMAL: return "normal";
+        case TaskSpec::PRIORITY_BULK: return "bulk";
+    }
+    return "unknown";
+}
+
+static size_t ring_of(uint8_t priority) {
+    return std::min<size_t>(priority, TaskQueue::PRIORITY_CLASSES - 1);
+}
+
+double TaskQueue::WaitStats::mean_ms() const {
+    return units == 0 ? 0.0 : total_ns / 1e6 / units;
+}
+
+double TaskQueue::WaitStats::percentile_ms(double q) const {
+    uint64_t rank = static_cast<uint64_t>(q * units + 0.999999);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < WAIT_BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen >= rank && seen > 0) {
+            return std::min((2ULL << b) / 1e3, max_ns / 1e6);
+        }
+    }
+    return max_ns / 1e6;
+}
+
 TaskQueue::TaskQueue(SharedMemory& shm, bool initialize)
     : data_(static_cast<QueueData*>(shm.get())),
       mutex_(&data_->mutex, initialize) {
     
+    if (shm.size() < sizeof(QueueData)) {
+        throw std::invalid_argument("Shared memory too small for task queue");
+    }
+    
     if (initialize) {
-        data_->head = 0;
-        data_->tail = 0;
+        std::memset(data_->rings, 0, sizeof(data_->rings));
+        std::memset(data_->credits, 0, sizeof(data_->credits));
+        std::memset(data_->waits, 0, sizeof(data_->waits));
+        set_weights(DEFAULT_WEIGHTS);
         data_->count = 0;
         data_->shutdown = false;
+        data_->succeeded = 0;
+        data_->failed = 0;
+        data_->completed_units = 0;
+        data_->arena_used = 0;
+        data_->leased = 0;
+        data_->completion_head = 0;
+        data_->completion_count = 0;
+        data_->keys_used = 0;
     }
 }
 
-bool TaskQueue::enqueue(const Task& task) {
-    mutex_.lock();
+void TaskQueue::set_weights(const uint32_t weights[PRIORITY_CLASSES]) {
+    for (size_t c = 0; c < PRIORITY_CLASSES; ++c) {
+        data_->weights[c] = std::max<uint32_t>(weights[c], 1);
+    }
+}
+
+bool TaskQueue::reserve_locked(const std::vector<TaskSpec>& tasks, size_t ring) {
+    if (data_->rings[ring].count + tasks.size() > MAX_TASKS) {
+        return false;  // Ring full
+    }
     
-    if (data_->shutdown) {
-        mutex_.unlock();
+    // Keep room for every completion the queued and leased tasks can produce
+    if (data_->count + data_->leased + data_->completion_count + tasks.size() >
+        MAX_COMPLETIONS) {
         return false;
     }
     
-    if (data_->count >= MAX_TASKS) {
+    size_t bytes = 0;
+    size_t new_keys = 0;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        bytes += tasks[i].input_file.size() + tasks[i].output_file.size() + 2;
+        
+        // Count keys not yet in the table (or earlier in this bundle)
+        const std::string& key = tasks[i].key;
+        size_t length = std::min(key.size(), MAX_KEY_BYTES);
+        bool known = false;
+        for (size_t k = 0; k < data_->keys_used && !known; ++k) {
+            known = length == data_->keys[k].length &&
+                    std::memcmp(key.data(), data_->keys[k].bytes, length) == 0;
+        }
+        for (size_t j = 0; j < i && !known; ++j) {
+            known = tasks[j].key.compare(0, MAX_KEY_BYTES, key, 0, MAX_KEY_BYTES) == 0;
+        }
+        if (!known) {
+            new_keys++;
+        }
+    }
+    
+    // Lower classes leave the tail of the arena to urgent units
+    size_t arena_limit = ring == TaskSpec::PRIORITY_HIGH ? ARENA_BYTES
+                                                         : ARENA_BYTES - HIGH_ARENA_BYTES;
+    if (data_->arena_used + bytes <= arena_limit &&
+        data_->keys_used + new_keys <= MAX_KEYS) {
+        return true;
+    }
+    
+    // Rewind the arena once nothing queued or leased refers to it
+    if (data_->count == 0 && data_->leased == 0) {
+        data_->arena_used = 0;
+        data_->keys_used = 0;
+        return bytes <= arena_limit && new_keys <= MAX_KEYS;
+    }
+    
+    return false;
+}
+
+uint32_t TaskQueue::intern_string_locked(const std::string& value) {
+    uint32_t ref = static_cast<uint32_t>(data_->arena_used);
+    std::memcpy(data_->arena + ref, value.c_str(), value.size() + 1);
+    data_->arena_used += value.size() + 1;
+    return ref;
+}
+
+uint16_t TaskQueue::intern_key_locked(const std::string& key) {
+    size_t length = std::min(key.size(), MAX_KEY_BYTES);
+    for (size_t k = 0; k < data_->keys_used; ++k) {
+        if (data_->keys[k].length == length &&
+            std::memcmp(data_->keys[k].bytes, key.data(), length) == 0) {
+            return static_cast<uint16_t>(k);
+        }
+    }
+    
+    KeySlot& slot = data_->keys[data_->keys_used];
+    slot.length = static_cast<uint32_t>(length);
+    std::memcpy(slot.bytes, key.data(), length);
+    return static_cast<uint16_t>(data_->keys_used++);
+}
+
+bool TaskQueue::enqueue(const TaskSpec& task) {
+    return enqueue_bundle(std::vector<TaskSpec>{task});
+}
+
+bool TaskQueue::enqueue_bundle(const std::vector<TaskSpec>& tasks) {
+    if (tasks.empty() || tasks.size() > MAX_BUNDLE) {
+        return false;
+    }
+    
+    size_t ring = ring_of(tasks.front().priority);
+    mutex_.lock();
+    
+    if (data_->shutdown || !reserve_locked(tasks, ring)) {
         mutex_.unlock();
-        return false;  // Queue full
+        return false;
     }
     
-    // Add task to tail
-    data_->tasks[data_->tail] = task;
-    data_->tail = (data_->tail + 1) % MAX_TASKS;
-    data_->count++;
+    // Consecutive slots; each records how many bundle members remain.
+    // Tail and count are published last so a writer dying mid-way leaves
+    // the ring consistent
+    size_t tail = data_->rings[ring].tail;
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        const TaskSpec& spec = tasks[i];
+        Task& slot = data_->tasks[ring][tail];
+        slot = Task();
+        slot.type = spec.type;
+        slot.flags = spec.flags;
+        slot.offset = spec.offset;
+        slot.length = spec.length;
+        slot.tag = spec.tag;
+        slot.priority = static_cast<uint8_t>(ring);
+        slot.enqueued_ns = spec.enqueued_ns != 0 ? spec.enqueued_ns : now;
+        slot.input_ref = intern_string_locked(spec.input_file);
+        slot.output_ref = intern_string_locked(spec.output_file);
+        slot.key_slot = intern_key_locked(spec.key);
+        slot.bundle_size = static_cast<uint32_t>(tasks.size() - i);
+        tail = (tail + 1) % MAX_TASKS;
+    }
+    data_->rings[ring].tail = tail;
+    data_->rings[ring].count += tasks.size();
+    data_->count += tasks.size();
     
     mutex_.unlock();
     return true;
 }
 
-bool TaskQueue::dequeue(Task& task) {
+bool TaskQueue::dequeue(TaskSpec& task) {
+    std::vector<TaskSpec> tasks;
+    if (!dequeue_bundle(tasks)) {
+        return false;
+    }
+    if (tasks.empty()) {
+        return true;
+    }
+    task = std::move(tasks.front());
+    return true;
+}
+
+int TaskQueue::pick_ring_locked() {
+    // Smooth weighted round-robin: every non-empty class earns its weight,
+    // the richest is served and pays back the round's total
+    int best = -1;
+    int64_t total = 0;
+    for (size_t c = 0; c < PRIORITY_CLASSES; ++c) {
+        if (data_->rings[c].count == 0) {
+            data_->credits[c] = 0;
+            continue;
+        }
+        data_->credits[c] += data_->weights[c];
+        total += data_->weights[c];
+        if (best < 0 || data_->credits[c] > data_->credits[best]) {
+            best = static_cast<int>(c);
+        }
+    }
+    if (best >= 0) {
+        data_->credits[best] -= total;
+    }
+    return best;
+}
+
+void TaskQueue::record_wait_locked(size_t ring, uint64_t wait_ns) {
+    WaitStats& stats = data_->waits[ring];
+    size_t bucket = 0;
+    for (uint64_t us = wait_ns / 1000; us > 1 && bucket + 1 < WAIT_BUCKETS; us >>= 1) {
+        bucket++;
+    }
+    stats.units++;
+    stats.total_ns += wait_ns;
+    stats.max_ns = std::max(stats.max_ns, wait_ns);
+    stats.buckets[bucket]++;
+}
+
+bool TaskQueue::dequeue_bundle(std::vector<TaskSpec>& tasks, int lease_slot, bool high_only) {
+    static thread_local std::vector<Task> descriptors;
+    descriptors.reserve(MAX_TASKS);
+    size_t n = 0;
+    
     mutex_.lock();
     
     if (data_->count == 0) {
         bool shutdown = data_->shutdown;
         mutex_.unlock();
+        tasks.clear();
         return !shutdown;  // Return false only if shutdown
     }
     
-    // Remove task from head
-    task = data_->tasks[data_->head];
-    data_->head = (data_->head + 1) % MAX_TASKS;
-    data_->count--;
+    int picked = high_only ? (data_->rings[TaskSpec::PRIORITY_HIGH].count > 0 ? 0 : -1)
+                           : pick_ring_locked();
+    if (picked < 0) {
+        mutex_.unlock();
+        tasks.clear();
+        return true;  // Nothing this worker may take
+    }
+    Ring& ring = data_->rings[picked];
+    
+    n = data_->tasks[picked][ring.head].bundle_size;
+    if (n == 0 || n > ring.count || n > MAX_BUNDLE) {
+        n = 1;
+    }
+    
+    size_t head = ring.head;
+    descriptors.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        descriptors[i] = data_->tasks[picked][head];
+        head = (head + 1) % MAX_TASKS;
+    }
+    uint64_t now = monotonic_ns();
+    if (descriptors[0].type != Task::TERMINATE) {
+        record_wait_locked(picked, now > descriptors[0].enqueued_ns ?
+                                       now - descriptors[0].enqueued_ns : 0);
+    }
+    
+    // Lease before unlinking from the ring: a crash in between can only
+    // duplicate the unit, never lose it
+    if (lease_slot >= 0 && static_cast<size_t>(lease_slot) < MAX_LEASES) {
+        Lease& lease = data_->leases[lease_slot];
+        std::copy(descriptors.begin(), descriptors.end(), lease.tasks);
+        lease.count = static_cast<uint32_t>(n);
+        data_->leased += n;
+    }
+    ring.head = head;
+    ring.count -= n;
+    data_->count -= n;
+    
+    // Strings are copied out before unlocking: once the descriptors leave
+    // the ring the arena may be rewound, and a worker killed mid-copy must
+    // not hold it. Reused TaskSpecs keep their string capacity
+    tasks.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        resolve(descriptors[i], tasks[i]);
+    }
     
     mutex_.unlock();
     return true;
 }
 
+void TaskQueue::resolve(const Task& task, TaskSpec& spec) const {
+    spec.type = task.type;
+    spec.flags = task.flags & ~PREFETCHED;
+    spec.offset = task.offset;
+    spec.length = task.length;
+    spec.tag = task.tag;
+    spec.enqueued_ns = task.enqueued_ns;
+    spec.priority = static_cast<TaskSpec::Priority>(ring_of(task.priority));
+    spec.input_file = data_->arena + task.input_ref;
+    spec.output_file = data_->arena + task.output_ref;
+    const KeySlot& slot = data_->keys[task.key_slot];
+    spec.key.assign(slot.bytes, slot.length);
+}
+
+void TaskQueue::complete_lease(int lease_slot, const std::vector<bool>& results) {
+    mutex_.lock();
+    Lease* lease = nullptr;
+    if (lease_slot >= 0 && static_cast<size_t>(lease_slot) < MAX_LEASES) {
+        lease = &data_->leases[lease_slot];
+    }
+    finish_lease_locked(lease, results);
+    mutex_.unlock();
+}
+
+void TaskQueue::finish_lease_locked(Lease* lease, const std::vector<bool>& results) {
+    if (lease) {
+        // Tagged tasks report back to the producer
+        for (size_t i = 0; i < lease->count && i < results.size(); ++i) {
+            if (lease->tasks[i].tag != 0 && data_->completion_count < MAX_COMPLETIONS) {
+                size_t index = (data_->completion_head + data_->completion_count) % MAX_COMPLETIONS;
+                data_->completions[index].tag = lease->tasks[i].tag;
+                data_->completions[index].success = results[i] ? 1 : 0;
+                data_->completion_count++;
+            }
+        }
+        
+        data_->leased -= lease->count;
+        lease->count = 0;
+    }
+    for (bool success : results) {
+        if (success) {
+            data_->succeeded++;
+        } else {
+            data_->failed++;
+        }
+    }
+    data_->completed_units++;
+}
+
+void TaskQueue::drain_completions(std::vector<Completion>& out) {
+    mutex_.lock();
+    while (data_->completion_count > 0) {
+        out.push_back(data_->completions[data_->completion_head]);
+        data_->completion_head = (data_->completion_head + 1) % MAX_COMPLETIONS;
+        data_->completion_count--;
+    }
+    mutex_.unlock();
+}
+
+TaskQueue::Requeue TaskQueue::requeue_lease(int lease_slot) {
+    if (lease_slot < 0 || static_cast<size_t>(lease_slot) >= MAX_LEASES) {
+        return Requeue::NONE;
+    }
+    
+    mutex_.lock();
+    
+    Lease& lease = data_->leases[lease_slot];
+    size_t n = lease.count;
+    if (n == 0) {
+        mutex_.unlock();
+        return Requeue::NONE;
+    }
+    
+    // A unit that already took down MAX_REQUEUES workers (a crash it
+    // triggers, or a hang) would cycle forever: fail it instead
+    if (lease.tasks[0].requeues >= MAX_REQUEUES) {
+        finish_lease_locked(&lease, std::vector<bool>(n, false));
+        mutex_.unlock();
+        return Requeue::ABANDONED;
+    }
+    
+    size_t picked = ring_of(lease.tasks[0].priority);
+    Ring& ring = data_->rings[picked];
+    if (ring.count + n > MAX_TASKS) {
+        mutex_.unlock();
+        return Requeue::NONE;
+    }
+    
+    // Back at the head of its ring: interrupted work goes first
+    size_t head = (ring.head + MAX_TASKS - n) % MAX_TASKS;
+    for (size_t i = 0; i < n; ++i) {
+        Task& slot = data_->tasks[picked][(head + i) % MAX_TASKS];
+        slot = lease.tasks[i];
+        slot.bundle_size = static_cast<uint32_t>(n - i);
+        slot.requeues++;
+    }
+    ring.head = head;
+    ring.count += n;
+    data_->count += n;
+    data_->leased -= n;
+    lease.count = 0;
+    
+    mutex_.unlock();
+    return Requeue::REQUEUED;
+}
+
+size_t TaskQueue::claim_prefetch(std::vector<TaskSpec>& out, size_t depth) {
+    out.clear();
+    mutex_.lock();
+    
+    // Only the windows at the ring heads, most urgent first: those tasks
+    // are dequeued next
+    size_t budget = depth;
+    for (size_t c = 0; c < PRIORITY_CLASSES && budget > 0; ++c) {
+        const Ring& ring = data_->rings[c];
+        size_t window = std::min(budget, ring.count);
+        budget -= window;
+        for (size_t i = 0; i < window; ++i) {
+            Task& slot = data_->tasks[c][(ring.head + i) % MAX_TASKS];
+            if (slot.type == Task::TERMINATE || (slot.flags & PREFETCHED)) {
+                continue;
+            }
+            slot.flags |= PREFETCHED;
+            
+            TaskSpec spec;
+            spec.input_file = data_->arena + slot.input_ref;
+            spec.offset = slot.offset;
+            spec.length = slot.length;
+            out.push_back(std::move(spec));
+        }
+    }
+    
+    mutex_.unlock();
+    return out.size();
+}
+
+TaskQueue::WaitStats TaskQueue::wait_stats(TaskSpec::Priority priority) const {
+    mutex_.lock();
+    WaitStats stats = data_->waits[ring_of(priority)];
+    mutex_.unlock();
+    return stats;
+}
+
+bool TaskQueue::has_lease(int lease_slot) const {
+    return lease_slot >= 0 && static_cast<size_t>(lease_slot) < MAX_LEASES &&
+           data_->leases[lease_slot].count > 0;
+}
+
+size_t TaskQueue::succeeded() const {
+    return data_->succeeded;
+}
+
+size_t TaskQueue::failed() const {
+    return data_->failed;
+}
+
+size_t TaskQueue::completed_units() const {
+    return __atomic_load_n(&data_->completed_units, __ATOMIC_ACQUIRE);
+}
+
 bool TaskQueue::is_empty() const {
     return data_->count == 0;
 }
 
 bool TaskQueue::is_full() const {
-    return data_->count >= MAX_TASKS;
+    for (size_t c = 0; c < PRIORITY_CLASSES; ++c) {
+        if (data_->rings[c].count < MAX_TASKS) {
+            return false;
+        }
+    }
+    return true;
 }
 
 size_t TaskQueue::size() const {
@@ -76,5 +489,5 @@ void TaskQueue::signal_shutdown() {
 bool TaskQueue::is_shutdown() const {
     return data_->shutdown;
 }
-
+    
 } // namespace cryptstream
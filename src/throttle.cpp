@@ -0,0 +1,141 @@
+#include "throttle.hpp"
+#include "heartbeat.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include <time.h>
+
+namespace cryptstream {
+
+Throttle* Throttle::active_ = nullptr;
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+Throttle::Throttle(SharedMemory& shm, bool initialize)
+    : state_(static_cast<State*>(shm.get())),
+      mutex_(&state_->mutex, initialize) {
+    
+    if (shm.size() < sizeof(State)) {
+        throw std::invalid_argument("Shared memory too small for throttle");
+    }
+    
+    if (initialize) {
+        state_->generation = 0;
+        for (Bucket& bucket : state_->buckets) {
+            bucket = Bucket();
+        }
+    }
+}
+
+void Throttle::set_limits(const Limits& limits) {
+    const uint64_t rates[RESOURCES] = {limits.read_bytes, limits.write_bytes,
+                                       limits.operations};
+    uint64_t now = monotonic_ns();
+    
+    mutex_.lock();
+    for (size_t r = 0; r < RESOURCES; ++r) {
+        // Debt run up at the old rate is forgiven; the new one applies now
+        state_->buckets[r].rate = rates[r];
+        state_->buckets[r].next_ns = now;
+    }
+    state_->generation++;
+    mutex_.unlock();
+}
+
+Throttle::Limits Throttle::limits() const {
+    mutex_.lock();
+    Limits limits;
+    limits.read_bytes = state_->buckets[READ_BYTES].rate;
+    limits.write_bytes = state_->buckets[WRITE_BYTES].rate;
+    limits.operations = state_->buckets[OPERATIONS].rate;
+    mutex_.unlock();
+    return limits;
+}
+
+uint64_t Throttle::throttled_ns(Resource resource) const {
+    return __atomic_load_n(&state_->buckets[resource].throttled_ns, __ATOMIC_RELAXED);
+}
+
+void Throttle::take(Resource resource, uint64_t amount) {
+    Bucket& bucket = state_->buckets[resource];
+    if (__atomic_load_n(&bucket.rate, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    
+    // Claim the next start slot; an idle bucket banks up to BURST_MS
+    uint64_t now = monotonic_ns();
+    mutex_.lock();
+    if (bucket.rate == 0) {
+        mutex_.unlock();
+        return;
+    }
+    uint64_t earliest = now - std::min<uint64_t>(now, BURST_MS * 1000000ULL);
+    uint64_t start = std::max(bucket.next_ns, earliest);
+    bucket.next_ns = start + static_cast<uint64_t>(amount * 1e9 / bucket.rate);
+    uint32_t generation = state_->generation;
+    mutex_.unlock();
+    
+    // Sleep in slices so a limit change releases the wait early; each
+    // slice counts as progress, or a throttled task would look hung
+    uint64_t waited = 0;
+    while (now < start && __atomic_load_n(&state_->generation, __ATOMIC_RELAXED) == generation) {
+        uint64_t slice = std::min<uint64_t>(start - now, SLICE_MS * 1000000ULL);
+        struct timespec ts = {static_cast<time_t>(slice / 1000000000ULL),
+                              static_cast<long>(slice % 1000000000ULL)};
+        nanosleep(&ts, nullptr);
+        Heartbeat::beat();
+        uint64_t after = monotonic_ns();
+        waited += after - now;
+        now = after;
+    }
+    if (waited > 0) {
+        __atomic_add_fetch(&bucket.throttled_ns, waited, __ATOMIC_RELAXED);
+    }
+}
+
+void Throttle::attach(Throttle* throttle) {
+    active_ = throttle;
+}
+
+bool Throttle::limited() {
+    if (!active_) {
+        return false;
+    }
+    for (const Bucket& bucket : active_->state_->buckets) {
+        if (__atomic_load_n(&bucket.rate, __ATOMIC_RELAXED) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Throttle::read(uint64_t bytes) {
+    if (active_) {
+        active_->take(OPERATIONS, 1);
+        active_->take(READ_BYTES, bytes);
+    }
+}
+
+void Throttle::write(uint64_t bytes) {
+    if (active_) {
+        active_->take(OPERATIONS, 1);
+        active_->take(WRITE_BYTES, bytes);
+    }
+}
+
+std::vector<std::string> Throttle::find(const std::string& prefix, pid_t pid) {
+    std::vector<std::string> names;
+    for (const std::string& run : live_ipc_runs(prefix, pid)) {
+        std::string name = run + "_throttle";
+        if (access((std::string(SHM_DIRECTORY) + name).c_str(), F_OK) == 0) {
+            names.push_back(name);
+        }
+    }
+    return names;
+}
+    
+} // namespace cryptstream
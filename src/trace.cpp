@@ -0,0 +1,120 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <cstdio>
+#include <unistd.h>
+
+namespace cryptstream {
+
+TraceBuffer::Slot* TraceBuffer::slot_ = nullptr;
+int32_t TraceBuffer::worker_id_ = -1;
+
+const char* trace_stage_name(TraceStage stage) {
+    switch (stage) {
+        case TraceStage::TASK:
+            return "task";
+        case TraceStage::QUEUE_WAIT:
+            return "queue wait";
+        case TraceStage::OPEN:
+            return "open";
+        case TraceStage::READ:
+            return "read";
+        case TraceStage::CRYPTO:
+            return "crypto";
+        case TraceStage::COMPRESS:
+            return "compress";
+        case TraceStage::WRITE:
+            return "write";
+        case TraceStage::COMMIT:
+            return "commit";
+    }
+    return "unknown";
+}
+
+TraceBuffer::TraceBuffer(size_t slots)
+    : shm_(sizeof(Slot) * std::max<size_t>(slots, 1)),
+      slots_(static_cast<Slot*>(shm_.get())),
+      slot_count_(std::max<size_t>(slots, 1)) {
+}
+
+void TraceBuffer::attach(TraceBuffer* buffer, size_t slot, int32_t worker_id) {
+    if (!buffer || slot >= buffer->slot_count_) {
+        slot_ = nullptr;
+        return;
+    }
+    slot_ = &buffer->slots_[slot];
+    worker_id_ = worker_id;
+}
+
+size_t TraceBuffer::span_count() const {
+    size_t total = 0;
+    for (size_t i = 0; i < slot_count_; ++i) {
+        total += __atomic_load_n(&slots_[i].count, __ATOMIC_ACQUIRE);
+    }
+    return total;
+}
+
+size_t TraceBuffer::dropped() const {
+    size_t total = 0;
+    for (size_t i = 0; i < slot_count_; ++i) {
+        total += __atomic_load_n(&slots_[i].dropped, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+bool TraceBuffer::write_chrome_json(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        std::cerr << "Failed to open trace file: " << path << std::endl;
+        return false;
+    }
+    
+    // Timestamps are relative to the earliest span, in microseconds
+    uint64_t origin = UINT64_MAX;
+    std::set<int32_t> workers;
+    for (size_t i = 0; i < slot_count_; ++i) {
+        uint64_t count = __atomic_load_n(&slots_[i].count, __ATOMIC_ACQUIRE);
+        for (uint64_t j = 0; j < count; ++j) {
+            origin = std::min(origin, slots_[i].spans[j].start_ns);
+            workers.insert(slots_[i].spans[j].worker_id);
+        }
+    }
+    
+    int pid = static_cast<int>(getpid());
+    const char* separator = "\n";
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    
+    // Name each worker's track
+    for (int32_t worker : workers) {
+        out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"tid\":" << worker << ",\"args\":{\"name\":\"worker " << worker << "\"}}";
+        separator = ",\n";
+    }
+    
+    char ts[32];
+    char dur[32];
+    for (size_t i = 0; i < slot_count_; ++i) {
+        uint64_t count = __atomic_load_n(&slots_[i].count, __ATOMIC_ACQUIRE);
+        for (uint64_t j = 0; j < count; ++j) {
+            const TraceSpan& span = slots_[i].spans[j];
+            std::snprintf(ts, sizeof(ts), "%.3f", (span.start_ns - origin) / 1e3);
+            std::snprintf(dur, sizeof(dur), "%.3f", span.duration_ns / 1e3);
+            out << separator << "{\"name\":\"" << trace_stage_name(span.stage)
+                << "\",\"cat\":\"task\",\"ph\":\"X\",\"ts\":" << ts << ",\"dur\":" << dur
+                << ",\"pid\":" << pid << ",\"tid\":" << span.worker_id
+                << ",\"args\":{\"bytes\":" << span.bytes << "}}";
+            separator = ",\n";
+        }
+    }
+    
+    out << "\n]}\n";
+    
+    if (dropped() > 0) {
+        std::cerr << "Trace buffer full: " << dropped() << " span(s) dropped" << std::endl;
+    }
+    return out.good();
+}
+    
+} // namespace cryptstream
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+# Run every CryptStream test suite from the repository root
+
+cd "$(dirname "$0")/.."
+
+STATUS=0
+for suite in tests/test_*.sh; do
+    bash "$suite" || STATUS=1
+done
+
+exit $STATUS
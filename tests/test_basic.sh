@@ -29,11 +29,11 @@ run_test() {
     
     if eval "$command" > /dev/null 2>&1; then
         echo -e "${GREEN}PASSED${NC}"
-        ((TESTS_PASSED++))
+        TESTS_PASSED=$((TESTS_PASSED + 1))
         return 0
     else
         echo -e "${RED}FAILED${NC}"
-        ((TESTS_FAILED++))
+        TESTS_FAILED=$((TESTS_FAILED + 1))
         return 1
     fi
 }
@@ -71,6 +71,168 @@ run_test "Encrypt large file" "$CRYPTSTREAM encrypt large_file.dat large_encrypt
 run_test "Decrypt large file" "$CRYPTSTREAM decrypt large_encrypted.enc large_decrypted.dat --key $TEST_KEY --processes 4"
 run_test "Large file content matches" "diff large_file.dat large_decrypted.dat"
 
+# Test 9: Batch with a giant (split) file and packed small files
+for i in 1 2 3 4 5 6 7 8; do
+    head -c $((i * 300)) /dev/urandom > small_$i.dat
+    echo "small_$i.dat small_$i.enc" >> encrypt_list.txt
+    echo "small_$i.enc small_$i.dec" >> decrypt_list.txt
+done
+echo "large_file.dat batch_large.enc" >> encrypt_list.txt
+echo "batch_large.enc batch_large.dec" >> decrypt_list.txt
+run_test "Batch encrypt" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --processes 4"
+run_test "Batch decrypt" "$CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --processes 4 --decrypt"
+run_test "Batch content matches" "diff large_file.dat batch_large.dec && for i in 1 2 3 4 5 6 7 8; do diff small_\$i.dat small_\$i.dec || exit 1; done"
+run_test "Invalid pool options rejected" "(for v in '--processes -1' '--processes x' '--processes 0' '--min-processes -2' '--idle-timeout abc' '--idle-timeout -5' '--lease-timeout x' '--lease-timeout -1'; do $CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY \$v; [ \$? -eq 1 ] || exit 1; done)"
+
+# Test 10: Quiet mode keeps stdout empty; worker logs still reach debug level
+run_test "Quiet batch prints nothing" "test -z \"\$($CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --processes 4 --quiet)\""
+run_test "Debug log shows tasks" "$CRYPTSTREAM encrypt large_file.dat large_debug.enc --key $TEST_KEY --processes 4 --log-level debug | grep -q 'completed task'"
+
+# Test 11: Chrome trace covers every task stage
+run_test "Trace batch" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --processes 4 --trace trace.json"
+run_test "Trace has stage spans" "grep -q '\"queue wait\"' trace.json && grep -q '\"read\"' trace.json && grep -q '\"crypto\"' trace.json && grep -q '\"write\"' trace.json"
+
+# Test 12: A budget below the range size streams tasks in chunks
+run_test "Budgeted batch encrypt" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --processes 4 --memory-budget 256K | grep -q 'streamed in chunks'"
+run_test "Budgeted batch decrypt" "$CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --processes 4 --memory-budget 256K --decrypt"
+run_test "Invalid memory budgets rejected" "(for v in abc -5 1x; do $CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --memory-budget \$v; [ \$? -eq 1 ] || exit 1; done)"
+run_test "Budgeted content matches" "diff large_file.dat batch_large.dec"
+
+# Test 13: Deep readahead and cache-keeping runs round-trip
+run_test "Prefetch batch encrypt" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --processes 4 --prefetch 16 --keep-cache"
+run_test "No-prefetch batch decrypt" "$CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --processes 4 --prefetch 0 --decrypt"
+run_test "Prefetch content matches" "diff large_file.dat batch_large.dec && diff small_8.dat small_8.dec"
+run_test "Invalid prefetch depths rejected" "(for v in x -1 2x 100000; do $CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --prefetch \$v; [ \$? -eq 1 ] || exit 1; done)"
+
+# Test 14: Durable outputs are committed whole, with no temp files left behind
+run_test "Durable batch encrypt" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --processes 4 --durable"
+run_test "Durable batch decrypt" "$CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --processes 4 --durable --decrypt"
+run_test "Durable content matches" "diff large_file.dat batch_large.dec && diff small_3.dat small_3.dec"
+run_test "No durable temp files left" "test -z \"\$(ls -A | grep cryptstream-tmp)\""
+run_test "Failed output writes fail the task" "! $CRYPTSTREAM encrypt small_1.dat /dev/full --key $TEST_KEY && ! $CRYPTSTREAM encrypt large_file.dat /dev/full --key $TEST_KEY --compress"
+
+# Test 15: Compressed streams shrink text and round-trip
+for i in $(seq 1 2000); do echo "2026-01-01,host$((i % 5)),GET /items/$i,200"; done > log.csv
+run_test "Compressed encrypt" "$CRYPTSTREAM encrypt log.csv log.csz --key $TEST_KEY --compress"
+run_test "Compressed output is smaller" "test \$(stat -c %s log.csz) -lt \$(( \$(stat -c %s log.csv) / 2 ))"
+run_test "Compressed decrypt" "$CRYPTSTREAM decrypt log.csz log.out --key $TEST_KEY --compress"
+run_test "Compressed content matches" "diff log.csv log.out"
+run_test "Compressed batch round-trip" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --compress && $CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --compress --decrypt && diff large_file.dat batch_large.dec"
+run_test "Oversized compressed chunks refused" "printf 'CSZ1\\000\\000\\000\\004' > huge_chunk.csz && ! $CRYPTSTREAM decrypt huge_chunk.csz huge_chunk.out --key $TEST_KEY --compress"
+
+# Test 16: Direct I/O matches the buffered path, including an unaligned tail
+head -c 3000001 /dev/urandom > odd_size.dat
+run_test "Direct encrypt (split ranges)" "$CRYPTSTREAM encrypt odd_size.dat odd_direct.enc --key $TEST_KEY --direct --processes 4"
+run_test "Direct output matches buffered" "$CRYPTSTREAM encrypt odd_size.dat odd_buffered.enc --key $TEST_KEY && cmp odd_direct.enc odd_buffered.enc"
+run_test "Direct decrypt" "$CRYPTSTREAM decrypt odd_direct.enc odd_size.out --key $TEST_KEY --direct && cmp odd_size.dat odd_size.out"
+run_test "Direct batch round-trip" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --direct && $CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --direct --decrypt && diff large_file.dat batch_large.dec"
+
+# Test 17: Concurrent jobs get their own IPC objects and clean up stale ones
+touch /dev/shm/cryptstream.999999.0-stale_queue /dev/shm/sem.cryptstream.999999.0-stale_task_sem
+run_test "Stale IPC objects removed" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --quiet && ! ls /dev/shm/cryptstream.999999.* /dev/shm/sem.cryptstream.999999.*"
+stress_jobs() {
+    local pids=""
+    for i in $(seq 1 16); do
+        head -c $((100000 + i * 7919)) /dev/urandom > stress_$i.dat
+        ( $CRYPTSTREAM encrypt stress_$i.dat stress_$i.enc --key key$i --processes 3 --quiet &&
+          $CRYPTSTREAM decrypt stress_$i.enc stress_$i.out --key key$i --processes 3 --quiet &&
+          cmp stress_$i.dat stress_$i.out ) &
+        pids="$pids $!"
+    done
+    local status=0
+    for pid in $pids; do
+        wait $pid || status=1
+    done
+    return $status
+}
+run_test "16 concurrent jobs round-trip" "stress_jobs"
+run_test "No IPC objects left behind" "! ls /dev/shm | grep -q 'cryptstream\.'"
+
+# Test 18: Coordinator and remote workers over loopback TCP
+cluster_run() {
+    local mode=$1 port=$((20000 + RANDOM % 20000))
+    rm -f batch_large.enc small_*.enc
+    $CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --listen 127.0.0.1:$port $mode --quiet &
+    local coordinator=$!
+    ! $CRYPTSTREAM worker --connect 127.0.0.1:$port --key wrong_key --quiet || return 1
+    for i in 1 2 3; do
+        $CRYPTSTREAM worker --connect 127.0.0.1:$port --key $TEST_KEY --quiet &
+    done
+    wait $coordinator || return 1
+    wait
+    $CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --decrypt --quiet &&
+        diff large_file.dat batch_large.dec && diff small_8.dat small_8.dec
+}
+run_test "Cluster round-trip (shared paths)" "cluster_run"
+run_test "Cluster round-trip (streamed data)" "cluster_run --stream"
+remote_progress() {
+    local port=$((20000 + RANDOM % 20000))
+    head -c 64000000 /dev/urandom > slow.dat
+    echo 'slow.dat slow.enc' > slow_list.txt
+    $CRYPTSTREAM batch slow_list.txt --key $TEST_KEY --listen 127.0.0.1:$port --processes 1 --compress --lease-timeout 50 > slow.log 2>&1 &
+    local coordinator=$!
+    $CRYPTSTREAM worker --connect 127.0.0.1:$port --key $TEST_KEY --quiet || return 1
+    wait $coordinator && ! grep -q 'lost worker' slow.log
+}
+run_test "Remote lease runs from the last progress" "remote_progress && $CRYPTSTREAM decrypt slow.enc slow.dec --key $TEST_KEY --compress --quiet && cmp -s slow.dat slow.dec && rm -f slow.dat slow.enc slow.dec"
+
+# Test 19: Packed archive of many small files, single-member extract and unpack
+mkdir -p pack_src/nested
+for i in $(seq 1 200); do head -c $((i * 37)) /dev/urandom > pack_src/m_$i.bin; done
+head -c 3000000 /dev/urandom > "pack_src/nested/large member.bin"
+find pack_src -type f > pack_list.txt
+run_test "Pack archive" "$CRYPTSTREAM pack pack_list.txt files.csa --key $TEST_KEY --processes 3 --quiet"
+run_test "Archive has segments and an index" "ls files.csa/seg-000 files.csa/index && ! ls files.csa/*.list"
+run_test "Extract one member" "$CRYPTSTREAM extract files.csa 'pack_src/nested/large member.bin' one.out --key $TEST_KEY && cmp one.out 'pack_src/nested/large member.bin'"
+run_test "Unknown member rejected" "! $CRYPTSTREAM extract files.csa pack_src/missing.bin missing.out --key $TEST_KEY"
+run_test "Unpack all members" "$CRYPTSTREAM unpack files.csa unpacked --key $TEST_KEY && diff -r pack_src unpacked/pack_src"
+
+# Test 20: Sparse files keep their holes and zero blocks through a round-trip
+truncate -s 64M sparse.img
+dd if=/dev/urandom of=sparse.img bs=1M count=2 seek=20 conv=notrunc status=none
+dd if=/dev/zero of=sparse.img bs=1M count=2 seek=40 conv=notrunc status=none
+printf 'tail' >> sparse.img
+run_test "Sparse encrypt (split ranges)" "$CRYPTSTREAM encrypt sparse.img sparse.enc --key $TEST_KEY --sparse --processes 4"
+run_test "Sparse output stays sparse" "test \$(du -k sparse.enc | cut -f1) -lt 8192"
+run_test "Sparse decrypt" "$CRYPTSTREAM decrypt sparse.enc sparse.out --key $TEST_KEY --sparse && cmp sparse.img sparse.out"
+run_test "Plain decrypt refuses sparse ciphertext" "! $CRYPTSTREAM decrypt sparse.enc sparse_plain.out --key $TEST_KEY"
+run_test "Sparse batch round-trip" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --sparse && $CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --sparse --decrypt && diff large_file.dat batch_large.dec"
+
+# Test 21: Priority classes, an urgent job beside a bulk batch, reserved workers
+echo "small_1.dat urgent_1.enc" > urgent_list.txt
+run_test "Bulk batch with urgent job" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --processes 3 --priority bulk --urgent urgent_list.txt | grep -q 'Queue wait (high): 1 unit'"
+run_test "Urgent job output decrypts" "$CRYPTSTREAM decrypt urgent_1.enc urgent_1.dec --key $TEST_KEY && diff small_1.dat urgent_1.dec"
+run_test "Invalid reserved worker counts rejected" "(for v in -1 x 1x; do $CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --reserved-workers \$v; [ \$? -eq 1 ] || exit 1; done)"
+run_test "Reserved worker batch round-trip" "$CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --processes 3 --reserved-workers 1 --urgent urgent_list.txt && $CRYPTSTREAM batch decrypt_list.txt --key $TEST_KEY --processes 3 --reserved-workers 1 --decrypt && diff large_file.dat batch_large.dec"
+run_test "Unknown priority rejected" "! $CRYPTSTREAM batch encrypt_list.txt --key $TEST_KEY --priority urgent"
+
+# Test 22: Shared I/O limits, adjusted at runtime with the throttle command
+head -c 2000000 /dev/urandom > throttle.dat
+run_test "Read limit slows the job" "start=\$(date +%s%N); $CRYPTSTREAM encrypt throttle.dat throttle.enc --key $TEST_KEY --max-read-mbps 1 | grep -q 'Throttled: read' && [ \$(( (\$(date +%s%N) - start) / 1000000 )) -ge 800 ]"
+run_test "Limited output decrypts" "$CRYPTSTREAM decrypt throttle.enc throttle.dec --key $TEST_KEY --max-write-mbps 4 --max-iops 50 && diff throttle.dat throttle.dec"
+run_test "Throttle lifts a running job's limit" "start=\$(date +%s%N); $CRYPTSTREAM encrypt throttle.dat throttle_live.enc --key $TEST_KEY --max-read-mbps 0.2 --quiet & job=\$!; sleep 0.5; $CRYPTSTREAM throttle \$job | grep -q 'read 0.2 MB/s' && $CRYPTSTREAM throttle \$job --max-read-mbps 0 | grep -q 'read unlimited' && wait \$job && [ \$(( (\$(date +%s%N) - start) / 1000000 )) -lt 5000 ] && cmp -s throttle.enc throttle_live.enc"
+run_test "Throttle of unknown pid fails" "! $CRYPTSTREAM throttle 1"
+run_test "Invalid limits rejected" "(for v in '--max-iops -5' '--max-iops 0.5' '--max-read-mbps abc' '--max-write-mbps -1'; do $CRYPTSTREAM encrypt throttle.dat throttle.enc --key $TEST_KEY \$v; [ \$? -eq 1 ] || exit 1; done)"
+run_test "Throttle of a non-numeric pid fails" "$CRYPTSTREAM throttle foo; [ \$? -eq 1 ]"
+run_test "A throttled task is not taken for hung" "timeout 30 $CRYPTSTREAM encrypt throttle.dat throttle_lease.enc --key $TEST_KEY --max-read-mbps 0.5 --lease-timeout 300 2>&1 | grep -q 'missed its heartbeat'; [ \$? -eq 1 ] && cmp -s throttle.enc throttle_lease.enc"
+
+# Test 23: In-place runs (input == output) must not truncate before reading
+head -c 8000000 /dev/urandom > inplace.dat
+cp inplace.dat inplace_orig.dat
+run_test "In-place split encrypt changes the file" "$CRYPTSTREAM encrypt inplace.dat inplace.dat --key $TEST_KEY --processes 4 && ! cmp -s inplace.dat inplace_orig.dat"
+run_test "In-place split decrypt restores it" "$CRYPTSTREAM decrypt inplace.dat inplace.dat --key $TEST_KEY --processes 4 && diff inplace.dat inplace_orig.dat"
+run_test "In-place batch round-trip" "echo 'inplace.dat inplace.dat' > inplace_list.txt && $CRYPTSTREAM batch inplace_list.txt --key $TEST_KEY --processes 4 && $CRYPTSTREAM batch inplace_list.txt --key $TEST_KEY --processes 4 --decrypt && diff inplace.dat inplace_orig.dat"
+run_test "In-place direct I/O round-trip" "$CRYPTSTREAM encrypt inplace.dat inplace.dat --key $TEST_KEY --processes 4 --direct && $CRYPTSTREAM decrypt inplace.dat inplace.dat --key $TEST_KEY --processes 4 --direct && diff inplace.dat inplace_orig.dat"
+run_test "In-place sparse round-trip" "$CRYPTSTREAM encrypt inplace.dat inplace.dat --key $TEST_KEY --processes 4 --sparse && $CRYPTSTREAM decrypt inplace.dat inplace.dat --key $TEST_KEY --processes 4 --sparse && diff inplace.dat inplace_orig.dat"
+stream_inplace() {
+    local mode=$1 port=$((20000 + RANDOM % 20000))
+    $CRYPTSTREAM batch inplace_list.txt --key $TEST_KEY --listen 127.0.0.1:$port --stream $mode --quiet &
+    local coordinator=$!
+    $CRYPTSTREAM worker --connect 127.0.0.1:$port --key $TEST_KEY --quiet || return 1
+    wait $coordinator
+}
+run_test "In-place streamed cluster round-trip" "stream_inplace && ! cmp -s inplace.dat inplace_orig.dat && stream_inplace --decrypt && diff inplace.dat inplace_orig.dat"
+
 # Cleanup
 cd ..
 rm -rf test_files